@@ -0,0 +1,603 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Apache Arrow IPC file export, written directly: a small
+ * back-to-front FlatBuffers builder makes the metadata, and
+ * the column buffers are copied out as they are filled.
+ * Rows are the tree in preorder, with columns parent (row
+ * of the parent, -1 at the root), size, depth and name,
+ * and with dir_counts also entries and subdirs; a chain
+ * folded by -c is one row, as in the text tree. The
+ * names are interned into one dictionary, written as a
+ * single dictionary batch ahead of the record batches, so
+ * the name column holds only indices. Every buffer is
+ * padded to 64 bytes, so a reader can mmap the file and use
+ * the columns in place. Little-endian hosts only, as Arrow
+ * data is little-endian.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+
+#define ARROW_BATCH_ROWS (1024 * 1024)
+#define ARROW_ALIGN 64
+
+#define ARROW_SEED 0x6172726f77000001ULL
+
+/* Arrow format constants, from Schema.fbs and Message.fbs. */
+#define METADATA_V5 4
+#define HEADER_SCHEMA 1
+#define HEADER_DICTIONARY_BATCH 2
+#define HEADER_RECORD_BATCH 3
+#define TYPE_INT 2
+#define TYPE_UTF8 5
+
+#define N_COLUMNS 6       // The last two only with dir_counts
+
+static int n_columns(void) {
+    return dir_counts ? N_COLUMNS : N_COLUMNS - 2;
+}
+
+/*
+ * FlatBuffers builder. The buffer is filled from the end
+ * toward the front, so an object is always written before
+ * anything that refers to it, and is known by its distance
+ * from the end.
+ */
+
+#define FB_MAX_FIELDS 8
+
+struct fb {
+    unsigned char *buf;       // Data is the last size bytes
+    size_t cap, size;
+    size_t table_start;       // size when the open table began
+    uint32_t fields[FB_MAX_FIELDS];
+    int n_fields;
+};
+
+static void fb_reserve(struct fb *b, size_t n) {
+    if (b->size + n <= b->cap)
+        return;
+    size_t cap = b->cap ? b->cap : 1024;
+    while (cap < b->size + n)
+        cap *= 2;
+    unsigned char *buf = mem_malloc(MEM_OUTPUT, cap);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(buf + cap - b->size, b->buf + b->cap - b->size, b->size);
+    mem_free(MEM_OUTPUT, b->buf);
+    b->buf = buf;
+    b->cap = cap;
+}
+
+static void fb_push(struct fb *b, const void *p, size_t n) {
+    fb_reserve(b, n);
+    b->size += n;
+    memcpy(b->buf + b->cap - b->size, p, n);
+}
+
+/* Pad so that after extra more bytes, size is a multiple of align. */
+static void fb_prep(struct fb *b, size_t align, size_t extra) {
+    static const unsigned char zeros[8];
+    size_t pad = (align - (b->size + extra) % align) % align;
+
+    fb_push(b, zeros, pad);
+}
+
+static void fb_scalar(struct fb *b, int field, const void *p, size_t n) {
+    fb_prep(b, n, 0);
+    fb_push(b, p, n);
+    b->fields[field] = b->size;
+}
+
+static void fb_i64(struct fb *b, int field, int64_t v) {
+    fb_scalar(b, field, &v, 8);
+}
+
+static void fb_i32(struct fb *b, int field, int32_t v) {
+    fb_scalar(b, field, &v, 4);
+}
+
+static void fb_i16(struct fb *b, int field, int16_t v) {
+    fb_scalar(b, field, &v, 2);
+}
+
+static void fb_u8(struct fb *b, int field, uint8_t v) {
+    fb_scalar(b, field, &v, 1);
+}
+
+static void fb_uoffset(struct fb *b, uint32_t target) {
+    fb_prep(b, 4, 0);
+    uint32_t v = b->size + 4 - target;
+    fb_push(b, &v, 4);
+}
+
+static void fb_offset(struct fb *b, int field, uint32_t target) {
+    fb_uoffset(b, target);
+    b->fields[field] = b->size;
+}
+
+static void fb_start(struct fb *b, int n_fields) {
+    memset(b->fields, 0, sizeof(b->fields));
+    b->n_fields = n_fields;
+    b->table_start = b->size;
+}
+
+/* Close the open table, writing its vtable just before it. */
+static uint32_t fb_end(struct fb *b) {
+    int32_t placeholder = 0;
+
+    fb_prep(b, 4, 0);
+    fb_push(b, &placeholder, 4);
+    uint32_t table = b->size;
+
+    for (int i = b->n_fields - 1; i >= 0; i--) {
+        uint16_t v = b->fields[i] ? table - b->fields[i] : 0;
+        fb_push(b, &v, 2);
+    }
+    uint16_t header[2] = {4 + 2 * b->n_fields, table - b->table_start};
+    fb_push(b, header, 4);
+
+    int32_t soffset = b->size - table;
+    memcpy(b->buf + b->cap - table, &soffset, 4);
+    return table;
+}
+
+static uint32_t fb_string(struct fb *b, const char *s) {
+    size_t n = strlen(s);
+    uint32_t len = n;
+
+    fb_prep(b, 4, n + 1);
+    fb_push(b, "", 1);
+    fb_push(b, s, n);
+    fb_push(b, &len, 4);
+    return b->size;
+}
+
+/* A vector of n structs of elem bytes each. */
+static uint32_t fb_structs(struct fb *b, const void *p, size_t elem,
+                           uint32_t n, size_t align) {
+    fb_prep(b, 4, elem * n);
+    fb_prep(b, align, elem * n);
+    fb_push(b, p, elem * n);
+    fb_push(b, &n, 4);
+    return b->size;
+}
+
+static uint32_t fb_offsets(struct fb *b, const uint32_t *targets, uint32_t n) {
+    fb_prep(b, 4, 4 * n);
+    for (uint32_t i = n; i > 0; i--)
+        fb_uoffset(b, targets[i - 1]);
+    fb_push(b, &n, 4);
+    return b->size;
+}
+
+/* Point the buffer's root at table; the result is 8-aligned. */
+static void fb_finish(struct fb *b, uint32_t root) {
+    fb_prep(b, 8, 4);
+    fb_uoffset(b, root);
+}
+
+static const unsigned char *fb_data(struct fb *b) {
+    return b->buf + b->cap - b->size;
+}
+
+/*
+ * Schema and message metadata.
+ */
+
+static uint32_t int_type(struct fb *b, int bits, int is_signed) {
+    fb_start(b, 2);
+    fb_i32(b, 0, bits);
+    fb_u8(b, 1, is_signed);
+    return fb_end(b);
+}
+
+static uint32_t field(struct fb *b, const char *name, int type_type,
+                      uint32_t type, uint32_t dictionary) {
+    uint32_t children = fb_offsets(b, 0, 0);
+    uint32_t name_off = fb_string(b, name);
+
+    fb_start(b, 7);
+    fb_offset(b, 0, name_off);
+    fb_u8(b, 1, 0);
+    fb_u8(b, 2, type_type);
+    fb_offset(b, 3, type);
+    if (dictionary)
+        fb_offset(b, 4, dictionary);
+    fb_offset(b, 5, children);
+    return fb_end(b);
+}
+
+static uint32_t schema(struct fb *b) {
+    uint32_t fields[N_COLUMNS];
+
+    fields[0] = field(b, "parent", TYPE_INT, int_type(b, 32, 1), 0);
+    fields[1] = field(b, "size", TYPE_INT, int_type(b, 64, 0), 0);
+    fields[2] = field(b, "depth", TYPE_INT, int_type(b, 32, 1), 0);
+
+    uint32_t index_type = int_type(b, 32, 1);
+    fb_start(b, 4);
+    fb_i64(b, 0, 0);
+    fb_offset(b, 1, index_type);
+    fb_u8(b, 2, 0);
+    uint32_t dictionary = fb_end(b);
+    fb_start(b, 0);
+    uint32_t utf8 = fb_end(b);
+    fields[3] = field(b, "name", TYPE_UTF8, utf8, dictionary);
+    if (dir_counts) {
+        fields[4] = field(b, "entries", TYPE_INT, int_type(b, 64, 0), 0);
+        fields[5] = field(b, "subdirs", TYPE_INT, int_type(b, 32, 0), 0);
+    }
+
+    uint32_t vector = fb_offsets(b, fields, n_columns());
+    fb_start(b, 4);
+    fb_i16(b, 0, 0);
+    fb_offset(b, 1, vector);
+    return fb_end(b);
+}
+
+struct node {
+    int64_t length, null_count;
+};
+
+struct buffer {
+    int64_t offset, length;
+};
+
+static uint32_t record_batch(struct fb *b, int64_t length,
+                             struct node *nodes, uint32_t n_nodes,
+                             struct buffer *buffers, uint32_t n_buffers) {
+    uint32_t nodes_off = fb_structs(b, nodes, sizeof(nodes[0]), n_nodes, 8);
+    uint32_t buffers_off = fb_structs(b, buffers, sizeof(buffers[0]),
+                                      n_buffers, 8);
+
+    fb_start(b, 3);
+    fb_i64(b, 0, length);
+    fb_offset(b, 1, nodes_off);
+    fb_offset(b, 2, buffers_off);
+    return fb_end(b);
+}
+
+static void message(struct fb *b, int header_type, uint32_t header,
+                    int64_t body_length) {
+    fb_start(b, 5);
+    fb_i16(b, 0, METADATA_V5);
+    fb_u8(b, 1, header_type);
+    fb_offset(b, 2, header);
+    fb_i64(b, 3, body_length);
+    fb_finish(b, fb_end(b));
+}
+
+/*
+ * The file: messages and their bodies, then the footer,
+ * which lists where each batch begins.
+ */
+
+struct block {
+    int64_t offset;
+    int32_t meta_length;
+    int32_t pad;
+    int64_t body_length;
+};
+
+struct writer {
+    FILE *out;
+    int64_t offset;           // Bytes written so far
+    struct fb fb;
+    struct block *batches;
+    uint32_t n_batches, max_batches;
+    struct block dictionary;
+
+    /* Name dictionary. */
+    const char **names;
+    uint32_t n_names;
+    uint32_t *slots;          // Name index + 1, or 0 if empty
+    uint32_t mask;
+    int32_t *name_ids;        // By entry index
+    char root_name[DU_PATH_MAX + 1];
+    char **joined;            // Copies of folded chain names
+    uint32_t n_joined;
+
+    /* The batch being filled. */
+    int32_t *parent;
+    uint64_t *size;
+    int32_t *depth;
+    int32_t *name;
+    uint64_t *own;            // Entries, with dir_counts
+    uint32_t *subdirs;
+    uint32_t n_rows;
+    int32_t next_row;
+};
+
+static void write_bytes(struct writer *w, const void *p, size_t n) {
+    if (fwrite(p, 1, n, w->out) != n) {
+        perror("fwrite");
+        exit(1);
+    }
+    w->offset += n;
+}
+
+static void write_zeros(struct writer *w, size_t n) {
+    static const unsigned char zeros[ARROW_ALIGN];
+
+    write_bytes(w, zeros, n);
+}
+
+static void write_padded(struct writer *w, const void *p, size_t n) {
+    write_bytes(w, p, n);
+    write_zeros(w, (ARROW_ALIGN - n % ARROW_ALIGN) % ARROW_ALIGN);
+}
+
+static int64_t padded(int64_t n) {
+    return (n + ARROW_ALIGN - 1) / ARROW_ALIGN * ARROW_ALIGN;
+}
+
+/* Write the message in w->fb, and return where it began. */
+static struct block write_message(struct writer *w, int64_t body_length) {
+    struct block k = {w->offset, 8 + w->fb.size, 0, body_length};
+    uint32_t prefix[2] = {0xffffffff, w->fb.size};
+
+    write_bytes(w, prefix, 8);
+    write_bytes(w, fb_data(&w->fb), w->fb.size);
+    w->fb.size = 0;
+    return k;
+}
+
+static uint32_t intern(struct writer *w, const char *s) {
+    uint32_t i = hash64(s, strlen(s), ARROW_SEED) & w->mask;
+
+    while (w->slots[i]) {
+        if (!strcmp(w->names[w->slots[i] - 1], s))
+            return w->slots[i] - 1;
+        i = (i + 1) & w->mask;
+    }
+    w->names[w->n_names] = s;
+    w->slots[i] = ++w->n_names;
+    return w->n_names - 1;
+}
+
+/* The same, for a name that must be copied to be kept. */
+static uint32_t intern_copy(struct writer *w, const char *s) {
+    uint32_t n = w->n_names;
+    uint32_t id = intern(w, s);
+
+    if (w->n_names > n) {
+        char *copy = mem_malloc(MEM_OUTPUT, strlen(s) + 1);
+        if (!copy) {
+            perror("malloc");
+            exit(1);
+        }
+        strcpy(copy, s);
+        w->names[id] = copy;
+        w->joined[w->n_joined++] = copy;
+    }
+    return id;
+}
+
+static void intern_subtree(struct writer *w, struct entry *e, uint32_t depth) {
+    struct entry *end = chain_end(e);
+    char name[DU_PATH_MAX + 1];
+
+    for (uint32_t i = 0; i < end->n_children; i++) {
+        struct entry *c = end->children[i];
+        if (c->n_chain == 0)
+            w->name_ids[c - entries] =
+                intern(w, c->components[c->n_components - 1]);
+        else if (chain_name(c, depth + 1, name, sizeof(name)))
+            w->name_ids[c - entries] = intern_copy(w, name);
+        else {
+            fprintf(stderr, "arrow: path too long\n");
+            exit(1);
+        }
+        intern_subtree(w, c, depth + 1);
+    }
+}
+
+static void write_dictionary(struct writer *w) {
+    int32_t *offsets = mem_malloc(MEM_OUTPUT,
+                                  (w->n_names + 1) * sizeof(offsets[0]));
+    int64_t total = 0;
+
+    if (!offsets) {
+        perror("malloc");
+        exit(1);
+    }
+    offsets[0] = 0;
+    for (uint32_t i = 0; i < w->n_names; i++) {
+        total += strlen(w->names[i]);
+        if (total > INT32_MAX) {
+            fprintf(stderr, "arrow: names too long for one dictionary\n");
+            exit(1);
+        }
+        offsets[i + 1] = total;
+    }
+
+    int64_t offsets_length = (w->n_names + 1) * sizeof(offsets[0]);
+    struct node node = {w->n_names, 0};
+    struct buffer buffers[3] = {
+        {0, 0},
+        {0, offsets_length},
+        {padded(offsets_length), total},
+    };
+    int64_t body_length = padded(offsets_length) + padded(total);
+
+    uint32_t data = record_batch(&w->fb, w->n_names, &node, 1, buffers, 3);
+    fb_start(&w->fb, 3);
+    fb_i64(&w->fb, 0, 0);
+    fb_offset(&w->fb, 1, data);
+    fb_u8(&w->fb, 2, 0);
+    message(&w->fb, HEADER_DICTIONARY_BATCH, fb_end(&w->fb), body_length);
+    w->dictionary = write_message(w, body_length);
+
+    write_padded(w, offsets, offsets_length);
+    for (uint32_t i = 0; i < w->n_names; i++)
+        write_bytes(w, w->names[i], strlen(w->names[i]));
+    write_zeros(w, padded(total) - total);
+    mem_free(MEM_OUTPUT, offsets);
+}
+
+static void flush_batch(struct writer *w) {
+    int64_t n = w->n_rows;
+    struct node nodes[N_COLUMNS];
+    struct buffer buffers[2 * N_COLUMNS];
+    const void *data[N_COLUMNS] = {w->parent, w->size, w->depth, w->name,
+                                   w->own, w->subdirs};
+    int64_t widths[N_COLUMNS] = {4, 8, 4, 4, 8, 4};
+    int64_t body_length = 0;
+
+    if (n == 0)
+        return;
+    for (int i = 0; i < n_columns(); i++) {
+        nodes[i].length = n;
+        nodes[i].null_count = 0;
+        buffers[2 * i].offset = body_length;
+        buffers[2 * i].length = 0;
+        buffers[2 * i + 1].offset = body_length;
+        buffers[2 * i + 1].length = n * widths[i];
+        body_length += padded(n * widths[i]);
+    }
+
+    uint32_t batch = record_batch(&w->fb, n, nodes, n_columns(),
+                                  buffers, 2 * n_columns());
+    message(&w->fb, HEADER_RECORD_BATCH, batch, body_length);
+    if (w->n_batches >= w->max_batches) {
+        w->max_batches = w->max_batches ? 2 * w->max_batches : 16;
+        w->batches = mem_realloc(MEM_OUTPUT, w->batches,
+                                 w->max_batches * sizeof(w->batches[0]));
+        if (!w->batches) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    w->batches[w->n_batches++] = write_message(w, body_length);
+
+    for (int i = 0; i < n_columns(); i++)
+        write_padded(w, data[i], n * widths[i]);
+    w->n_rows = 0;
+}
+
+static void add_rows(struct writer *w, struct entry *e, int32_t parent,
+                     uint32_t depth) {
+    struct entry *end = chain_end(e);
+    int32_t row = w->next_row++;
+    uint32_t k = w->n_rows++;
+
+    w->parent[k] = parent;
+    w->size[k] = e->size;
+    w->depth[k] = depth;
+    w->name[k] = w->name_ids[e - entries];
+    if (dir_counts)
+        w->own[k] = dir_entries(e, &w->subdirs[k]);
+    if (w->n_rows == ARROW_BATCH_ROWS)
+        flush_batch(w);
+
+    for (uint32_t i = 0; i < end->n_children; i++)
+        add_rows(w, end->children[i], row, depth + 1);
+}
+
+static void *alloc_column(size_t n) {
+    void *p = mem_malloc(MEM_OUTPUT, n);
+    if (!p) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * Write the tree under root to out as an Arrow IPC file,
+ * in batches of up to ARROW_BATCH_ROWS rows.
+ */
+void show_arrow(FILE *out, struct entry *root) {
+    struct writer w;
+    static const char magic[8] = "ARROW1";
+
+    memset(&w, 0, sizeof(w));
+    w.out = out;
+
+    uint32_t n_slots = 1;
+    while (n_slots < 2 * (uint32_t) n_entries)
+        n_slots *= 2;
+    w.mask = n_slots - 1;
+    w.slots = mem_calloc(MEM_OUTPUT, n_slots, sizeof(w.slots[0]));
+    w.names = alloc_column(n_entries * sizeof(w.names[0]));
+    w.name_ids = alloc_column(n_entries * sizeof(w.name_ids[0]));
+    w.joined = alloc_column(n_entries * sizeof(w.joined[0]));
+    if (!w.slots) {
+        perror("malloc");
+        exit(1);
+    }
+    if (!chain_name(root, 0, w.root_name, sizeof(w.root_name))) {
+        fprintf(stderr, "arrow: root path too long\n");
+        exit(1);
+    }
+    w.name_ids[root - entries] = intern(&w, w.root_name);
+    intern_subtree(&w, root, 0);
+
+    write_bytes(&w, magic, sizeof(magic));
+    message(&w.fb, HEADER_SCHEMA, schema(&w.fb), 0);
+    write_message(&w, 0);
+    write_dictionary(&w);
+
+    w.parent = alloc_column(ARROW_BATCH_ROWS * sizeof(w.parent[0]));
+    w.size = alloc_column(ARROW_BATCH_ROWS * sizeof(w.size[0]));
+    w.depth = alloc_column(ARROW_BATCH_ROWS * sizeof(w.depth[0]));
+    w.name = alloc_column(ARROW_BATCH_ROWS * sizeof(w.name[0]));
+    if (dir_counts) {
+        w.own = alloc_column(ARROW_BATCH_ROWS * sizeof(w.own[0]));
+        w.subdirs = alloc_column(ARROW_BATCH_ROWS * sizeof(w.subdirs[0]));
+    }
+    add_rows(&w, root, -1, 0);
+    flush_batch(&w);
+
+    /* End of stream, then the footer. */
+    uint32_t eos[2] = {0xffffffff, 0};
+    write_bytes(&w, eos, sizeof(eos));
+
+    uint32_t schema_off = schema(&w.fb);
+    uint32_t dictionaries = fb_structs(&w.fb, &w.dictionary,
+                                       sizeof(w.dictionary), 1, 8);
+    uint32_t batches = fb_structs(&w.fb, w.batches, sizeof(w.batches[0]),
+                                  w.n_batches, 8);
+    fb_start(&w.fb, 5);
+    fb_i16(&w.fb, 0, METADATA_V5);
+    fb_offset(&w.fb, 1, schema_off);
+    fb_offset(&w.fb, 2, dictionaries);
+    fb_offset(&w.fb, 3, batches);
+    fb_finish(&w.fb, fb_end(&w.fb));
+    int32_t footer_length = w.fb.size;
+    write_bytes(&w, fb_data(&w.fb), w.fb.size);
+    write_bytes(&w, &footer_length, 4);
+    write_bytes(&w, magic, 6);
+
+    mem_free(MEM_OUTPUT, w.parent);
+    mem_free(MEM_OUTPUT, w.size);
+    mem_free(MEM_OUTPUT, w.depth);
+    mem_free(MEM_OUTPUT, w.name);
+    mem_free(MEM_OUTPUT, w.own);
+    mem_free(MEM_OUTPUT, w.subdirs);
+    mem_free(MEM_OUTPUT, w.slots);
+    mem_free(MEM_OUTPUT, w.names);
+    mem_free(MEM_OUTPUT, w.name_ids);
+    for (uint32_t i = 0; i < w.n_joined; i++)
+        mem_free(MEM_OUTPUT, w.joined[i]);
+    mem_free(MEM_OUTPUT, w.joined);
+    mem_free(MEM_OUTPUT, w.batches);
+    mem_free(MEM_OUTPUT, w.fb.buf);
+}
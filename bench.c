@@ -0,0 +1,392 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Microbenchmarks for the hot kernels of duvis, run in
+ * isolation on generated du output. The generator is seeded
+ * and the report is one line per kernel and thread count,
+ * so runs are comparable across commits.
+ */
+
+#define DUVIS_NO_MAIN
+#include "duvis.c"
+
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+/*
+ * Generated tree: the top levels fan out fully, and below
+ * them directories have a few subdirectories at random,
+ * slightly under one on average, for a long-tailed depth.
+ */
+#define BENCH_TOP_FANOUT 12
+#define BENCH_TOP_LEVELS 3
+#define BENCH_MAX_DEPTH 24
+
+static uint64_t bench_seed = 1;
+
+static uint64_t bench_random(void) {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+/* Generated du output, in du's postorder. */
+static char *text;
+static size_t n_text, max_text;
+
+static void text_append(const char *s, size_t n) {
+    while (n_text + n > max_text) {
+        max_text = max_text ? 2 * max_text : 1024 * 1024;
+        text = realloc(text, max_text);
+        if (!text) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(text + n_text, s, n);
+    n_text += n;
+}
+
+/* Emit the subtree at path, returning its size. */
+static uint64_t generate(char *path, size_t n_path, int depth,
+                         int *budget) {
+    uint64_t size = 4 + bench_random() % 64;
+    int fanout = 0;
+
+    if (depth == 0)
+        fanout = *budget;
+    else if (depth < BENCH_TOP_LEVELS)
+        fanout = BENCH_TOP_FANOUT;
+    else if (depth < BENCH_MAX_DEPTH) {
+        int r = bench_random() % 16;
+        fanout = r < 11 ? 0 : r - 10;
+    }
+
+    for (int i = 0; i < fanout && *budget > 0; i++) {
+        size_t n = n_path;
+        int n_name = 2 + bench_random() % 8;
+        path[n++] = '/';
+        for (int j = 0; j < n_name; j++)
+            path[n++] = 'a' + bench_random() % 26;
+        /* Sibling names are unique: end with the index. */
+        n += sprintf(path + n, "%d", i);
+        (*budget)--;
+        size += generate(path, n, depth + 1, budget);
+    }
+
+    char line[32];
+    int n_line = sprintf(line, "%" PRIu64 "\t", size);
+    text_append(line, n_line);
+    text_append(path, n_path);
+    text_append("\n", 1);
+    return size;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void) {
+#if HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Entry tables saved between kernels. */
+static struct entry *du_order, *sorted;
+static int n_bench;
+
+static void restore(struct entry *from) {
+    memcpy(entries, from, n_bench * sizeof(entries[0]));
+    n_entries = n_bench;
+}
+
+static void shuffle_children(size_t start, size_t end, void *arg) {
+    for (size_t i = start; i < end; i++) {
+        struct entry *e = &entries[i];
+        for (uint32_t j = e->n_children; j > 1; j--) {
+            uint32_t k = (i * 2654435761u + j) % j;
+            struct entry *t = e->children[j - 1];
+            e->children[j - 1] = e->children[k];
+            e->children[k] = t;
+        }
+    }
+}
+
+static FILE *devnull;
+static int repeats = 3;
+
+/* Kernels. Each runs once; setup is done outside the timing. */
+
+static void k_path_get(void) {
+    FILE *f = fmemopen(text, n_text, "r");
+    while (1) {
+        char *path = path_alloc();
+        if (path_get(path, DU_BUFFER_LENGTH, f, 0) <= 0)
+            break;
+    }
+    fclose(f);
+}
+
+/* The du text again, as a file for stream_entries(). */
+static FILE *text_file;
+
+static void k_stream_entries(void) {
+    rewind(text_file);
+    n_entries = 0;
+    stream_entries(dup(fileno(text_file)), 0, 0);
+}
+
+static char **size_fields;
+
+static void k_size_parse(void) {
+    uint64_t total = 0;
+    for (int i = 0; i < n_bench; i++) {
+        uint64_t size;
+        sscanf(size_fields[i], "%" PRIu64, &size);
+        total += size;
+    }
+    if (total == 0)
+        fprintf(stderr, "size_parse: zero total\n");
+}
+
+static void k_compare_entries(void) {
+    pool_sort(entries, n_entries, sizeof(entries[0]), compare_entries);
+}
+
+static void k_compare_subtrees(void) {
+    sort_children();
+}
+
+static void k_build_preorder(void) {
+    build_tree_preorder();
+}
+
+static void k_build_postorder(void) {
+    build_tree_postorder();
+}
+
+static void k_find_max_depths(void) {
+    find_max_depths(root_entry);
+}
+
+static void k_show_entries(void) {
+    show_tree(devnull, root_entry);
+}
+
+/* Setups, run before each repeat. */
+
+static void s_none(void) {
+}
+
+static void s_du_order(void) {
+    restore(du_order);
+    root_entry = &entries[n_entries - 1];
+    base_depth = root_entry->n_components;
+}
+
+static void s_shuffled(void) {
+    restore(du_order);
+    for (int i = n_entries - 1; i > 0; i--) {
+        int j = bench_random() % (i + 1);
+        struct entry t = entries[i];
+        entries[i] = entries[j];
+        entries[j] = t;
+    }
+}
+
+static void s_sorted(void) {
+    restore(sorted);
+    root_entry = &entries[0];
+    base_depth = root_entry->n_components;
+}
+
+static void s_built(void) {
+    s_sorted();
+    build_tree_preorder();
+    sort_children();
+}
+
+static void s_unsorted_children(void) {
+    s_sorted();
+    build_tree_preorder();
+    pool_for(0, n_entries, 0, shuffle_children, 0);
+}
+
+struct kernel {
+    char *name;
+    void (*setup)(void);
+    void (*run)(void);
+    int counts_bytes;         // Report bytes/cycle of the du text
+};
+
+static struct kernel kernels[] = {
+    {"path_get", s_none, k_path_get, 1},
+    {"stream_entries", s_none, k_stream_entries, 1},
+    {"size_parse", s_none, k_size_parse, 0},
+    {"compare_entries", s_shuffled, k_compare_entries, 0},
+    {"compare_subtrees", s_unsorted_children, k_compare_subtrees, 0},
+    {"build_preorder", s_sorted, k_build_preorder, 0},
+    {"build_postorder", s_du_order, k_build_postorder, 0},
+    {"find_max_depths", s_built, k_find_max_depths, 0},
+    {"show_entries", s_built, k_show_entries, 1},
+};
+
+#define N_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static void run_kernels(int n_threads, char *only) {
+    pool_init(n_threads);
+
+    /* Parse once for the tables the later kernels start from. */
+    k_stream_entries();
+    n_bench = n_entries;
+    du_order = malloc(n_bench * sizeof(entries[0]));
+    sorted = malloc(n_bench * sizeof(entries[0]));
+    size_fields = malloc(n_bench * sizeof(size_fields[0]));
+    if (!du_order || !sorted || !size_fields) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(du_order, entries, n_bench * sizeof(entries[0]));
+    memcpy(sorted, entries, n_bench * sizeof(entries[0]));
+    qsort(sorted, n_bench, sizeof(sorted[0]), compare_entries);
+    for (int i = 0; i < n_bench; i++)
+        size_fields[i] = du_order[i].path;
+
+    for (int k = 0; k < N_KERNELS; k++) {
+        struct kernel *kn = &kernels[k];
+        if (only && strcmp(only, kn->name))
+            continue;
+
+        double best = 0;
+        uint64_t best_cycles = 0;
+        for (int r = 0; r < repeats; r++) {
+            kn->setup();
+            double t0 = now();
+            uint64_t c0 = cycles();
+            kn->run();
+            uint64_t c1 = cycles();
+            double t1 = now();
+            if (r == 0 || t1 - t0 < best) {
+                best = t1 - t0;
+                best_cycles = c1 - c0;
+            }
+        }
+
+        printf("%-18s %3d %10d %10.1f", kn->name, n_threads, n_bench,
+               best * 1e9 / n_bench);
+        if (kn->counts_bytes && HAVE_CYCLES && best_cycles > 0)
+            printf(" %10.3f\n", (double) n_text / best_cycles);
+        else
+            printf(" %10s\n", "-");
+        fflush(stdout);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: bench [-n entries] [-r repeats] "
+            "[-t threads,...] [-k kernel] [-s seed]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int n_wanted = 1000000;
+    char *thread_list = "1";
+    char *only = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:r:t:k:s:")) != -1) {
+        switch (c) {
+            case 'n':
+                n_wanted = atoi(optarg);
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                break;
+            case 't':
+                thread_list = optarg;
+                break;
+            case 'k':
+                only = optarg;
+                break;
+            case 's':
+                bench_seed = strtoull(optarg, 0, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc || n_wanted < 1 || repeats < 1 || bench_seed == 0)
+        usage();
+
+    devnull = fopen("/dev/null", "w");
+    if (!devnull) {
+        perror("/dev/null");
+        exit(1);
+    }
+
+    uint64_t seed = bench_seed;
+    char path[DU_PATH_MAX + 1] = "root";
+    int budget = n_wanted - 1;
+    generate(path, strlen(path), 0, &budget);
+
+    text_file = tmpfile();
+    if (!text_file || fwrite(text, 1, n_text, text_file) != n_text ||
+        fflush(text_file)) {
+        perror("tmpfile");
+        exit(1);
+    }
+
+    printf("# seed %" PRIu64 " entries %d bytes %zu repeats %d\n",
+           seed, n_wanted, n_text, repeats);
+    printf("# %-16s %3s %10s %10s %10s\n",
+           "kernel", "thr", "entries", "ns/entry", "bytes/cyc");
+    fflush(stdout);
+
+    /*
+     * The pool is sized once per process, so each thread
+     * count gets a fresh child forked from this
+     * single-threaded parent.
+     */
+    for (char *s = thread_list; *s; ) {
+        int n_threads = atoi(s);
+        if (n_threads < 1)
+            usage();
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            run_kernels(n_threads, only);
+            exit(0);
+        }
+        int wstatus;
+        if (waitpid(pid, &wstatus, 0) == -1 ||
+            !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+            fprintf(stderr, "bench: %d threads failed\n", n_threads);
+            exit(1);
+        }
+        s += strcspn(s, ",");
+        s += *s == ',';
+    }
+    return 0;
+}
@@ -0,0 +1,407 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Chunk-hash cache of parsed du input. The input is cut into
+ * content-defined chunks on line boundaries using a gear
+ * rolling hash, so an edit early in a capture only disturbs
+ * the chunks around it. Each chunk is stored in the cache
+ * with a 128-bit hash of its text next to its parsed
+ * entries; on the next run chunks whose hash and length are
+ * found are spliced in from the cache instead of being
+ * parsed again.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+
+#define CACHE_MAGIC "DUVISC1\n"
+#define CACHE_VERSION 2
+
+/* Two seeds, for 128 bits of chunk hash. */
+#define CHUNK_SEED_1 0
+#define CHUNK_SEED_2 0x6368756e6b000002ULL
+
+/*
+ * Chunk boundaries: past the minimum length, cut at the
+ * first line end after a position whose gear hash has the
+ * high bits clear, for chunks of a few tens of K of du
+ * output. The high bits depend on the last 64 bytes, where
+ * the low bits would see only the last few.
+ */
+#define CHUNK_MIN_LENGTH (16 * 1024)
+#define CHUNK_MASK (~0ULL << 50)
+#define CHUNK_MAX_LENGTH (1024 * 1024)
+
+#define CACHE_IO_LENGTH (1024 * 1024)
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t zeroflag;
+    uint64_t key_hash;
+    uint64_t n_chunks;
+    uint64_t table_offset;    // Chunk table follows the payloads
+};
+
+struct cache_chunk {
+    uint64_t hash[2];         // Hash of the du text of the chunk
+    uint64_t length;          // Length of the du text of the chunk
+    uint64_t n_entries;       // # of entries parsed from the chunk
+    uint64_t offset;          // Start of parsed entries in the file
+    uint64_t payload_length;  // Length of parsed entries in the file
+};
+
+static uint64_t gear[256];
+
+/* Previous cache, mapped read-only. */
+static char *old_map = 0;
+static size_t old_size = 0;
+static struct cache_chunk *old_chunks = 0;
+static uint64_t n_old_chunks = 0;
+
+/* Open-addressed index from chunk hash to old chunk. */
+static int64_t *old_index = 0;
+static uint64_t old_index_mask = 0;
+
+/* Cache being written. */
+static FILE *out = 0;
+static uint64_t out_offset = 0;
+static struct cache_chunk *new_chunks = 0;
+static uint64_t n_new_chunks = 0;
+static uint64_t max_new_chunks = 0;
+
+static uint64_t n_reused_chunks = 0;
+static uint64_t n_reused_bytes = 0;
+static uint64_t n_input_bytes = 0;
+
+static void out_write(const void *data, size_t len) {
+    if (fwrite(data, 1, len, out) != len) {
+        perror("cache: fwrite");
+        exit(1);
+    }
+    out_offset += len;
+}
+
+static void open_old_cache(const char *path, int zeroflag,
+                           uint64_t key_hash) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+        return;
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(struct cache_header)) {
+        close(fd);
+        return;
+    }
+
+    old_size = st.st_size;
+    old_map = mmap(0, old_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (old_map == MAP_FAILED) {
+        old_map = 0;
+        return;
+    }
+
+    struct cache_header header;
+    memcpy(&header, old_map, sizeof(header));
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) ||
+        header.version != CACHE_VERSION ||
+        header.zeroflag != zeroflag ||
+        header.key_hash != key_hash ||
+        header.table_offset > old_size ||
+        header.table_offset % sizeof(uint64_t) != 0 ||
+        header.n_chunks > (old_size - header.table_offset) /
+                          sizeof(struct cache_chunk)) {
+        fprintf(stderr, "cache: ignoring stale cache %s\n", path);
+        munmap(old_map, old_size);
+        old_map = 0;
+        return;
+    }
+
+    old_chunks = (struct cache_chunk *) (old_map + header.table_offset);
+    n_old_chunks = header.n_chunks;
+
+    uint64_t n_index = 16;
+
+    while (n_index < 2 * n_old_chunks)
+        n_index *= 2;
+    old_index = mem_malloc(MEM_CACHE, n_index * sizeof(old_index[0]));
+    if (!old_index) {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint64_t i = 0; i < n_index; i++)
+        old_index[i] = -1;
+    old_index_mask = n_index - 1;
+
+    for (uint64_t i = 0; i < n_old_chunks; i++) {
+        struct cache_chunk *c = &old_chunks[i];
+        if (c->offset > header.table_offset ||
+            c->payload_length > header.table_offset - c->offset)
+            continue;
+        uint64_t j = c->hash[0] & old_index_mask;
+        while (old_index[j] != -1)
+            j = (j + 1) & old_index_mask;
+        old_index[j] = i;
+    }
+}
+
+static struct cache_chunk *find_old_chunk(const uint64_t *hash,
+                                          uint64_t length) {
+    if (!old_index)
+        return 0;
+
+    for (uint64_t j = hash[0] & old_index_mask;
+         old_index[j] != -1;
+         j = (j + 1) & old_index_mask) {
+        struct cache_chunk *c = &old_chunks[old_index[j]];
+        if (c->hash[0] == hash[0] && c->hash[1] == hash[1] &&
+            c->length == length)
+            return c;
+    }
+    return 0;
+}
+
+/* Splice in the entries of a chunk from the old cache. */
+static void load_chunk(struct cache_chunk *c) {
+    const char *p = old_map + c->offset;
+    const char *end = p + c->payload_length;
+
+    for (uint64_t i = 0; i < c->n_entries; i++) {
+        uint64_t size;
+        uint32_t n_components, len;
+
+        if (end - p < sizeof(size) + 2 * sizeof(uint32_t)) {
+            fprintf(stderr, "cache: truncated chunk\n");
+            exit(1);
+        }
+        memcpy(&size, p, sizeof(size));
+        p += sizeof(size);
+        memcpy(&n_components, p, sizeof(n_components));
+        p += sizeof(n_components);
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if (end - p < len) {
+            fprintf(stderr, "cache: truncated chunk\n");
+            exit(1);
+        }
+        add_parsed(size, n_components, p, len);
+        p += len;
+    }
+}
+
+/* Store the parsed form of entries [first, n_entries). */
+static void save_entries(int first) {
+    for (int i = first; i < n_entries; i++) {
+        struct entry *e = &entries[i];
+        char *last = e->components[e->n_components - 1];
+        uint32_t len = last + strlen(last) + 1 - e->components[0];
+        out_write(&e->size, sizeof(e->size));
+        out_write(&e->n_components, sizeof(e->n_components));
+        out_write(&len, sizeof(len));
+        out_write(e->components[0], len);
+    }
+}
+
+static void parse_chunk(const char *chunk, uint64_t len, int zeroflag,
+                        int *line_number) {
+    char term = zeroflag ? '\0' : '\n';
+    const char *line = chunk;
+    const char *end = chunk + len;
+
+    while (line < end) {
+        const char *eol = memchr(line, term, end - line);
+        if (!eol) {
+            fprintf(stderr, "warning: unterminated final path\n");
+            eol = end;
+        }
+        if (eol - line > INT_MAX) {
+            fprintf(stderr, "line %d: path buffer overrun\n",
+                    *line_number + 1);
+            exit(1);
+        }
+        add_line(line, eol - line, ++*line_number);
+        line = eol + 1;
+    }
+}
+
+static void finish_chunk(const char *chunk, uint64_t len, int zeroflag,
+                         int *line_number) {
+    uint64_t hash[2] = {hash64(chunk, len, CHUNK_SEED_1),
+                        hash64(chunk, len, CHUNK_SEED_2)};
+    struct cache_chunk *old = find_old_chunk(hash, len);
+    int first = n_entries;
+
+    if (n_new_chunks >= max_new_chunks) {
+        max_new_chunks = max_new_chunks ? 2 * max_new_chunks : 1024;
+        new_chunks = mem_realloc(MEM_CACHE, new_chunks,
+                             max_new_chunks * sizeof(new_chunks[0]));
+        if (!new_chunks) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    struct cache_chunk *c = &new_chunks[n_new_chunks++];
+    c->hash[0] = hash[0];
+    c->hash[1] = hash[1];
+    c->length = len;
+    c->offset = out_offset;
+
+    if (old) {
+        load_chunk(old);
+        out_write(old_map + old->offset, old->payload_length);
+        *line_number += old->n_entries;
+        n_reused_chunks++;
+        n_reused_bytes += len;
+    } else {
+        parse_chunk(chunk, len, zeroflag, line_number);
+        save_entries(first);
+    }
+
+    c->n_entries = n_entries - first;
+    c->payload_length = out_offset - c->offset;
+}
+
+/*
+ * Read du output from f as stream_entries() would, reusing
+ * parsed chunks from the cache for key in cache_dir, and
+ * leave an updated cache behind.
+ */
+void cache_read_entries(FILE *f, int zeroflag,
+                        const char *cache_dir, const char *key) {
+    uint64_t key_hash = hash64(key, strlen(key), 0);
+    char path[DU_PATH_MAX], tmp_path[DU_PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/%016" PRIx64 ".cache",
+                 cache_dir, key_hash) >= sizeof(path) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%ld",
+                 path, (long) getpid()) >= sizeof(tmp_path)) {
+        fprintf(stderr, "cache: directory name too long\n");
+        exit(1);
+    }
+
+    uint64_t seed = 0;
+    for (int i = 0; i < 256; i++)
+        gear[i] = hash_split(&seed);
+
+    open_old_cache(path, zeroflag, key_hash);
+
+    out = fopen(tmp_path, "w");
+    if (!out) {
+        perror(tmp_path);
+        exit(1);
+    }
+    setvbuf(out, 0, _IOFBF, CACHE_IO_LENGTH);
+
+    struct cache_header header;
+    memset(&header, 0, sizeof(header));
+    out_write(&header, sizeof(header));
+
+    char *block = mem_malloc(MEM_CACHE, CACHE_IO_LENGTH);
+    uint64_t max_chunk = CHUNK_MAX_LENGTH + DU_PATH_MAX;
+    char *chunk = mem_malloc(MEM_CACHE, max_chunk);
+
+    if (!block || !chunk) {
+        perror("malloc");
+        exit(1);
+    }
+
+    char term = zeroflag ? '\0' : '\n';
+    uint64_t n_chunk = 0;
+    uint64_t g = 0;
+    int cut = 0;
+    int line_number = 0;
+
+    while (1) {
+        size_t n_block = fread(block, 1, CACHE_IO_LENGTH, f);
+        if (n_block == 0)
+            break;
+        n_input_bytes += n_block;
+        for (size_t i = 0; i < n_block; i++) {
+            unsigned char ch = block[i];
+            if (n_chunk >= max_chunk) {
+                max_chunk *= 2;
+                chunk = mem_realloc(MEM_CACHE, chunk, max_chunk);
+                if (!chunk) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            chunk[n_chunk++] = ch;
+            g = (g << 1) + gear[ch];
+            if (ch == term && (cut || n_chunk >= CHUNK_MAX_LENGTH)) {
+                finish_chunk(chunk, n_chunk, zeroflag, &line_number);
+                n_chunk = 0;
+                g = 0;
+                cut = 0;
+            } else if (n_chunk >= CHUNK_MIN_LENGTH &&
+                       (g & CHUNK_MASK) == 0) {
+                cut = 1;
+            }
+        }
+    }
+    if (ferror(f)) {
+        perror("fread");
+        exit(1);
+    }
+    if (n_chunk > 0)
+        finish_chunk(chunk, n_chunk, zeroflag, &line_number);
+
+    mem_free(MEM_CACHE, chunk);
+    mem_free(MEM_CACHE, block);
+    trim_entries();
+
+    /* Write the chunk table and then the real header. */
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.zeroflag = zeroflag;
+    header.key_hash = key_hash;
+    header.n_chunks = n_new_chunks;
+    static const char pad[8];
+    out_write(pad, -out_offset & 7);
+    header.table_offset = out_offset;
+    out_write(new_chunks, n_new_chunks * sizeof(new_chunks[0]));
+    if (fseek(out, 0, SEEK_SET) == -1 ||
+        fwrite(&header, sizeof(header), 1, out) != 1 ||
+        fclose(out) == EOF) {
+        perror(tmp_path);
+        exit(1);
+    }
+    if (rename(tmp_path, path) == -1) {
+        perror(path);
+        exit(1);
+    }
+
+    fprintf(stderr, "cache: reused %" PRIu64 " of %" PRIu64
+            " chunks (%" PRIu64 " of %" PRIu64 " bytes)\n",
+            n_reused_chunks, n_new_chunks, n_reused_bytes, n_input_bytes);
+
+    if (old_map)
+        munmap(old_map, old_size);
+    mem_free(MEM_CACHE, old_index);
+    mem_free(MEM_CACHE, new_chunks);
+}
@@ -0,0 +1,444 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Estimated compressibility of each subtree of a du -a
+ * tree. The files are laid end to end in tree order, so
+ * each subtree is one range of bytes. Half the read budget
+ * goes to blocks sampled at random, each byte equally
+ * likely; the other half then gives one block to each
+ * subtree of at least a floor size that has none yet,
+ * deepest first. The floor is the total over that half of
+ * the budget, so the subtrees given one are disjoint and
+ * always fit. Each block is run through a fast LZ77 size
+ * estimate, and a subtree saves what its sampled blocks
+ * saved, in proportion to its size. Only subtrees under the
+ * floor can be left with no estimate. The reads are spread
+ * over the pool in device and inode order, for locality.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+#include "pool.h"
+
+#define COMPRESS_BLOCK_LENGTH (64 * 1024)
+
+/* Fixed, so that runs over the same files agree. */
+#define COMPRESS_SEED 0x636f6d7072657373ULL
+
+/* log2 of the match table size. */
+#define LZ_HASH_BITS 12
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+struct file {
+    struct entry *e;
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;            // In bytes
+    uint64_t start;           // Bytes of the files before this one
+};
+
+/* A subtree's files, as a range of bytes, by entry index. */
+struct range {
+    uint64_t lo, hi;
+};
+
+struct sample {
+    struct file *f;
+    uint64_t offset;
+    uint32_t length;          // Bytes read; 0 if the read failed
+    uint32_t packed;          // Estimated compressed length
+};
+
+static struct file *files = 0;
+static size_t n_files = 0;
+static struct sample *samples = 0;
+static size_t n_samples = 0;
+
+/* Sampled and packed bytes of each subtree, by entry index. */
+static uint64_t *sampled = 0;
+static uint64_t *packed = 0;
+
+static struct file **file_of = 0;  // By entry index; 0 if none
+static struct file *ordered = 0;   // The files in tree order
+static struct range *ranges = 0;
+static uint64_t total = 0;
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t w;
+    memcpy(&w, p, 4);
+    return w;
+}
+
+/*
+ * Length of the LZ4-style encoding of n bytes, counted but
+ * not written: greedy matches of at least four bytes found
+ * through a small hash table, each costing a token, two
+ * bytes of offset and the literals before it.
+ */
+static size_t lz_estimate(const unsigned char *p, size_t n) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t i = 0, anchor = 0, out = 0;
+
+    /* Positions are stored plus one, so 0 is empty. */
+    memset(table, 0, sizeof(table));
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t w = read32(p + i);
+        uint32_t h = (w * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[h];
+        table[h] = i + 1;
+        if (cand == 0 || i - (cand - 1) > LZ_MAX_OFFSET ||
+            read32(p + cand - 1) != w) {
+            i++;
+            continue;
+        }
+        cand--;
+        size_t len = LZ_MIN_MATCH;
+        while (i + len < n && p[cand + len] == p[i + len])
+            len++;
+        size_t lits = i - anchor;
+        out += 1 + lits / 255 + lits + 2 + (len - LZ_MIN_MATCH) / 255;
+        i += len;
+        anchor = i;
+    }
+    size_t lits = n - anchor;
+    out += 1 + lits / 255 + lits;
+
+    /* A block that does not shrink is stored. */
+    return out < n ? out : n;
+}
+
+static void stat_range(size_t start, size_t end, void *arg) {
+    char path[DU_PATH_MAX + 1];
+    struct stat st;
+
+    for (size_t i = start; i < end; i++) {
+        struct file *f = &files[i];
+        f->size = 0;
+        if (!entry_path(f->e, path, sizeof(path)) || lstat(path, &st) == -1)
+            continue;
+        if (!S_ISREG(st.st_mode))
+            continue;
+        f->dev = st.st_dev;
+        f->ino = st.st_ino;
+        f->size = st.st_size;
+    }
+}
+
+static void sample_range(size_t start, size_t end, void *arg) {
+    unsigned char *buf = mem_malloc(MEM_INPUT, COMPRESS_BLOCK_LENGTH);
+    char path[DU_PATH_MAX + 1];
+    struct file *open_file = 0;
+    int fd = -1;
+
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (size_t i = start; i < end; i++) {
+        struct sample *s = &samples[i];
+        s->length = 0;
+        /* Samples of one file are next to each other. */
+        if (s->f != open_file) {
+            if (fd != -1)
+                close(fd);
+            open_file = s->f;
+            fd = -1;
+            if (entry_path(s->f->e, path, sizeof(path)))
+                fd = open(path, O_RDONLY);
+        }
+        if (fd == -1)
+            continue;
+
+        size_t want = s->f->size - s->offset < COMPRESS_BLOCK_LENGTH ?
+            s->f->size - s->offset : COMPRESS_BLOCK_LENGTH;
+        size_t n = 0;
+        while (n < want) {
+            ssize_t r = pread(fd, buf + n, want - n, s->offset + n);
+            if (r == -1 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            n += r;
+        }
+        if (n < want)
+            continue;
+        s->length = n;
+        s->packed = lz_estimate(buf, n);
+    }
+    if (fd != -1)
+        close(fd);
+    mem_free(MEM_INPUT, buf);
+}
+
+static int compare_inodes(const void *p1, const void *p2) {
+    const struct file *f1 = p1;
+    const struct file *f2 = p2;
+
+    if (f1->dev != f2->dev)
+        return f1->dev < f2->dev ? -1 : 1;
+    if (f1->ino != f2->ino)
+        return f1->ino < f2->ino ? -1 : 1;
+    return 0;
+}
+
+static int compare_samples(const void *p1, const void *p2) {
+    const struct sample *s1 = p1;
+    const struct sample *s2 = p2;
+    int q = compare_inodes(s1->f, s2->f);
+
+    if (q != 0)
+        return q;
+    if (s1->offset != s2->offset)
+        return s1->offset < s2->offset ? -1 : 1;
+    return 0;
+}
+
+/* The file holding byte x of all the files end to end. */
+static struct file *find_byte(uint64_t x) {
+    size_t lo = 0, hi = n_files;
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (files[mid].start <= x)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return &files[lo];
+}
+
+static void add_sample(struct file *f, uint64_t offset) {
+    samples[n_samples].f = f;
+    samples[n_samples].offset = offset;
+    n_samples++;
+}
+
+/* Sample the block holding byte x of all the files. */
+static void add_byte(uint64_t x) {
+    struct file *f = find_byte(x);
+    uint64_t o = x - f->start;
+
+    add_sample(f, o - o % COMPRESS_BLOCK_LENGTH);
+}
+
+/* Lay the files under e end to end, in tree order. */
+static void lay_out(struct entry *e) {
+    size_t i = e - entries;
+
+    ranges[i].lo = total;
+    if (file_of[i]) {
+        struct file *f = &ordered[n_files++];
+        *f = *file_of[i];
+        f->start = total;
+        total += f->size;
+    }
+    for (uint32_t j = 0; j < e->n_children; j++)
+        lay_out(e->children[j]);
+    ranges[i].hi = total;
+}
+
+/* Whether any of the first n samples, sorted, falls in r. */
+static int sampled_in(struct range *r, uint64_t *xs, size_t n) {
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (xs[mid] < r->lo)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < n && xs[lo] < r->hi;
+}
+
+/*
+ * Give a block to each subtree under e of at least floor
+ * bytes that has none, children first; return whether e
+ * has one now.
+ */
+static int cover(struct entry *e, uint64_t floor, uint64_t *xs, size_t n,
+                 uint64_t *state) {
+    struct range *r = &ranges[e - entries];
+    int covered = 0;
+
+    for (uint32_t j = 0; j < e->n_children; j++)
+        covered |= cover(e->children[j], floor, xs, n, state);
+    if (!covered)
+        covered = sampled_in(r, xs, n);
+    if (!covered && r->hi - r->lo >= floor) {
+        add_byte(r->lo + hash_split(state) % (r->hi - r->lo));
+        covered = 1;
+    }
+    return covered;
+}
+
+static int compare_bytes(const void *p1, const void *p2) {
+    const uint64_t *x1 = p1;
+    const uint64_t *x2 = p2;
+
+    return *x1 < *x2 ? -1 : *x1 > *x2;
+}
+
+/* Sum the samples of each subtree into it. */
+static void rollup(struct entry *e) {
+    size_t i = e - entries;
+
+    for (uint32_t j = 0; j < e->n_children; j++) {
+        struct entry *c = e->children[j];
+        rollup(c);
+        sampled[i] += sampled[c - entries];
+        packed[i] += packed[c - entries];
+    }
+}
+
+static void show_savings(FILE *out, struct entry *e) {
+    size_t i = e - entries;
+
+    if (sampled[i] == 0) {
+        fputs(" ~?", out);
+        return;
+    }
+    uint64_t saved = sampled[i] - packed[i];
+    fprintf(out, " ~%" PRIu64 " (%" PRIu64 "%%)",
+            (uint64_t) ((double) e->size * saved / sampled[i]),
+            saved * 100 / sampled[i]);
+}
+
+/*
+ * Estimate the savings of compressing each subtree,
+ * reading at most budget bytes, and add them as a column
+ * of the text tree.
+ */
+void estimate_compression(uint64_t budget) {
+    for (int i = 0; i < n_entries; i++)
+        if (entries[i].n_children == 0)
+            n_files++;
+
+    files = mem_malloc(MEM_INPUT, n_files * sizeof(files[0]) + 1);
+    sampled = mem_calloc(MEM_OUTPUT, n_entries, sizeof(sampled[0]));
+    packed = mem_calloc(MEM_OUTPUT, n_entries, sizeof(packed[0]));
+    if (!files || !sampled || !packed) {
+        perror("malloc");
+        exit(1);
+    }
+    n_files = 0;
+    for (int i = 0; i < n_entries; i++)
+        if (entries[i].n_children == 0)
+            files[n_files++].e = &entries[i];
+
+    pool_for(0, n_files, 0, stat_range, 0);
+
+    /* Keep one name of each nonempty file, in inode order. */
+    pool_sort(files, n_files, sizeof(files[0]), compare_inodes);
+    size_t n = 0;
+    for (size_t i = 0; i < n_files; i++) {
+        if (files[i].size == 0)
+            continue;
+        if (n > 0 && !compare_inodes(&files[n - 1], &files[i]))
+            continue;
+        files[n++] = files[i];
+    }
+
+    /* Then lay them out in tree order. */
+    file_of = mem_calloc(MEM_INPUT, n_entries, sizeof(file_of[0]));
+    ordered = mem_malloc(MEM_INPUT, n * sizeof(ordered[0]) + 1);
+    ranges = mem_malloc(MEM_INPUT, n_entries * sizeof(ranges[0]));
+    if (!file_of || !ordered || !ranges) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++)
+        file_of[files[i].e - entries] = &files[i];
+    n_files = 0;
+    lay_out(root_entry);
+    mem_free(MEM_INPUT, files);
+    mem_free(MEM_INPUT, file_of);
+    files = ordered;
+
+    /* Read everything if it fits; otherwise sample. */
+    uint64_t n_blocks = 0;
+    for (size_t i = 0; i < n_files; i++)
+        n_blocks += (files[i].size + COMPRESS_BLOCK_LENGTH - 1) /
+            COMPRESS_BLOCK_LENGTH;
+    uint64_t max_samples = budget / COMPRESS_BLOCK_LENGTH;
+    if (max_samples == 0)
+        max_samples = 1;
+    size_t n_alloc = n_blocks < max_samples ? n_blocks : max_samples;
+    samples = mem_malloc(MEM_INPUT, n_alloc * sizeof(samples[0]) + 1);
+    if (!samples) {
+        perror("malloc");
+        exit(1);
+    }
+    if (n_blocks <= max_samples) {
+        for (size_t i = 0; i < n_files; i++)
+            for (uint64_t o = 0; o < files[i].size; o += COMPRESS_BLOCK_LENGTH)
+                add_sample(&files[i], o);
+    } else {
+        uint64_t state = COMPRESS_SEED;
+        size_t n_cover = n_alloc / 2, n_random = n_alloc - n_cover;
+        uint64_t *xs = mem_malloc(MEM_INPUT, n_random * sizeof(xs[0]));
+        if (!xs) {
+            perror("malloc");
+            exit(1);
+        }
+        for (size_t k = 0; k < n_random; k++) {
+            xs[k] = hash_split(&state) % total;
+            add_byte(xs[k]);
+        }
+        if (n_cover > 0) {
+            qsort(xs, n_random, sizeof(xs[0]), compare_bytes);
+            cover(root_entry, (total + n_cover - 1) / n_cover, xs, n_random,
+                  &state);
+        }
+        mem_free(MEM_INPUT, xs);
+    }
+    pool_sort(samples, n_samples, sizeof(samples[0]), compare_samples);
+
+    pool_for(0, n_samples, 0, sample_range, 0);
+
+    uint64_t bytes = 0, failed = 0;
+    for (size_t k = 0; k < n_samples; k++) {
+        struct sample *s = &samples[k];
+        if (s->length == 0) {
+            failed++;
+            continue;
+        }
+        size_t i = s->f->e - entries;
+        sampled[i] += s->length;
+        packed[i] += s->packed;
+        bytes += s->length;
+    }
+    rollup(root_entry);
+
+    fprintf(stderr, "compress: %zu files, %zu blocks, %" PRIu64
+            " bytes read\n", n_files, n_samples, bytes);
+    if (failed > 0)
+        fprintf(stderr, "warning: %" PRIu64 " blocks could not be read\n",
+                failed);
+
+    mem_free(MEM_INPUT, samples);
+    mem_free(MEM_INPUT, files);
+    mem_free(MEM_INPUT, ranges);
+    show_extra = show_savings;
+}
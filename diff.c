@@ -0,0 +1,287 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Streaming diff of two du captures. Both must be in sorted
+ * postorder: every directory after everything below it, and
+ * siblings in name order, as --output du writes them; plain
+ * du output is not, and is rejected. Then one merge over
+ * the two streams pairs up equal paths, and only the current
+ * and previous line of each is kept, so captures of any size
+ * diff in a few K of memory. A subtree added or removed
+ * whole is one change, at its top: in postorder a parent
+ * follows its subtree, so it is in the other capture just
+ * when that capture's next path is still inside it.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "duvis.h"
+#include "mem.h"
+
+#define DIFF_IO_LENGTH (1024 * 1024)
+
+struct capture {
+    const char *name;
+    FILE *f;
+    char term;
+    int line_number;
+    char *line;               // Current line, as read
+    size_t max_line;
+    char *prev;               // Path of the line before, for checking order
+    size_t max_prev;
+    uint64_t size;
+    char *path;               // Points into line; 0 at end of input
+};
+
+/*
+ * Order of paths in sorted postorder: compare component by
+ * component, and a path comes after all paths it is a
+ * prefix of.
+ */
+static int compare_postorder(const char *a, const char *b) {
+    while (1) {
+        /* At the end of a component in both. */
+        if ((*a == '/' || *a == '\0') && (*b == '/' || *b == '\0')) {
+            if (*a == '\0' && *b == '\0')
+                return 0;
+            if (*a == '\0')
+                return 1;
+            if (*b == '\0')
+                return -1;
+            a++;
+            b++;
+            continue;
+        }
+        /* One component ends first, so it sorts first. */
+        if (*a == '/' || *a == '\0')
+            return -1;
+        if (*b == '/' || *b == '\0')
+            return 1;
+        if (*a != *b)
+            return (unsigned char) *a - (unsigned char) *b;
+        a++;
+        b++;
+    }
+}
+
+/* Step to the next line of c, checking that it is in order. */
+static void next_line(struct capture *c) {
+    if (c->path) {
+        size_t n = strlen(c->path) + 1;
+        if (n > c->max_prev) {
+            c->max_prev = 2 * n;
+            c->prev = mem_realloc(MEM_INPUT, c->prev, c->max_prev);
+            if (!c->prev) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        memcpy(c->prev, c->path, n);
+    }
+
+    errno = 0;
+    ssize_t n = getdelim(&c->line, &c->max_line, c->term, c->f);
+    if (n == -1) {
+        if (errno) {
+            perror(c->name);
+            exit(1);
+        }
+        c->path = 0;
+        return;
+    }
+    c->line_number++;
+    if (c->line[n - 1] == c->term)
+        c->line[--n] = '\0';
+
+    char *index = c->line;
+    c->size = strtoull(c->line, &index, 10);
+    if (index == c->line || (*index != ' ' && *index != '\t')) {
+        fprintf(stderr, "%s line %d: buffer format error\n",
+                c->name, c->line_number);
+        exit(1);
+    }
+    c->path = index + 1;
+
+    if (c->line_number > 1 && compare_postorder(c->prev, c->path) >= 0) {
+        fprintf(stderr, "%s line %d: not in sorted postorder; "
+                "rewrite the capture with duvis --output du:FILE\n",
+                c->name, c->line_number);
+        exit(1);
+    }
+}
+
+static void open_capture(struct capture *c, const char *name,
+                         int zeroflag) {
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->term = zeroflag ? '\0' : '\n';
+    c->f = fopen(name, "r");
+    if (!c->f) {
+        perror(name);
+        exit(1);
+    }
+    if (setvbuf(c->f, 0, _IOFBF, DIFF_IO_LENGTH)) {
+        perror("setvbuf");
+        exit(1);
+    }
+    next_line(c);
+}
+
+static void close_capture(struct capture *c) {
+    fclose(c->f);
+    free(c->line);
+    mem_free(MEM_INPUT, c->prev);
+}
+
+/*
+ * True if the parent of path is in the capture whose next
+ * unread path is next.
+ */
+static int parent_in(const char *path, const char *next) {
+    const char *slash = strrchr(path, '/');
+
+    if (!slash)
+        return 1;
+    size_t n = slash - path;
+    return next && !strncmp(next, path, n) &&
+           (next[n] == '/' || next[n] == '\0');
+}
+
+static int worth(int64_t delta, uint64_t threshold) {
+    uint64_t magnitude = delta < 0 ? -(uint64_t) delta : delta;
+
+    return delta != 0 && magnitude >= threshold;
+}
+
+static void report(FILE *out, char kind, int64_t delta, const char *path,
+                   uint64_t threshold) {
+    if (worth(delta, threshold))
+        fprintf(out, "%c\t%+" PRId64 "\t%s\n", kind, delta, path);
+}
+
+/*
+ * Binary patches. After the magic "DUVP" and a version
+ * byte, each record is a kind byte and a stable node ID,
+ * as 8 little-endian bytes, then:
+ *   A  the parent's ID, the size and the name's length as
+ *      varints, and the name (the last component)
+ *   D  nothing; the node's whole subtree is removed
+ *   M  the new size, as a varint
+ * and the patch ends with E and the number of records, as a
+ * varint. Records come in postorder, so an added node's
+ * children are added before it. Every added node has its
+ * record, since the client needs them all, but a removed
+ * subtree has just one.
+ */
+#define PATCH_VERSION 1
+
+static uint64_t n_records = 0;
+
+static void put_varint(FILE *out, uint64_t v) {
+    while (v >= 0x80) {
+        putc((v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc(v, out);
+}
+
+static void put_id(FILE *out, uint64_t id) {
+    for (int i = 0; i < 8; i++)
+        putc(id >> (8 * i), out);
+}
+
+static void patch(FILE *out, char kind, const char *path, uint64_t size) {
+    putc(kind, out);
+    put_id(out, path_id(path));
+    if (kind == 'A') {
+        const char *slash = strrchr(path, '/');
+        const char *name = slash ? slash + 1 : path;
+        char *parent = strndup(path, slash ? slash - path : 0);
+        if (!parent) {
+            perror("strndup");
+            exit(1);
+        }
+        put_id(out, path_id(parent));
+        free(parent);
+        put_varint(out, size);
+        put_varint(out, strlen(name));
+        fputs(name, out);
+    } else if (kind == 'M') {
+        put_varint(out, size);
+    }
+    n_records++;
+}
+
+/*
+ * Write every path of new_name that was added (A), removed
+ * (D) or changed size (M) since old_name, with its change
+ * in size, when the change is at least threshold; of a
+ * subtree added or removed whole, only its top. Each line
+ * is written as soon as both streams have passed it. With
+ * binary, write a patch instead, in which threshold only
+ * holds back changes of size.
+ */
+void diff_captures(FILE *out, const char *old_name, const char *new_name,
+                   int zeroflag, uint64_t threshold, int binary) {
+    struct capture old, new;
+
+    open_capture(&old, old_name, zeroflag);
+    open_capture(&new, new_name, zeroflag);
+    if (binary) {
+        fputs("DUVP", out);
+        putc(PATCH_VERSION, out);
+    }
+
+    while (old.path || new.path) {
+        int q;
+        if (!old.path)
+            q = 1;
+        else if (!new.path)
+            q = -1;
+        else
+            q = compare_postorder(old.path, new.path);
+
+        if (q < 0) {
+            if (parent_in(old.path, new.path)) {
+                if (binary)
+                    patch(out, 'D', old.path, 0);
+                else
+                    report(out, 'D', -(int64_t) old.size, old.path,
+                           threshold);
+            }
+            next_line(&old);
+        } else if (q > 0) {
+            if (binary)
+                patch(out, 'A', new.path, new.size);
+            else if (parent_in(new.path, old.path))
+                report(out, 'A', new.size, new.path, threshold);
+            next_line(&new);
+        } else {
+            int64_t delta = new.size - old.size;
+            if (!binary)
+                report(out, 'M', delta, new.path, threshold);
+            else if (worth(delta, threshold))
+                patch(out, 'M', new.path, new.size);
+            next_line(&old);
+            next_line(&new);
+        }
+    }
+
+    if (binary) {
+        putc('E', out);
+        put_varint(out, n_records);
+    }
+    close_capture(&old);
+    close_capture(&new);
+}
@@ -0,0 +1,441 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Duplicate files among the leaves of a du -a tree. The
+ * candidates are narrowed in stages, each cheaper than the
+ * next: same size, then same hash of the first and last
+ * block, then the same bytes. A file is dropped as soon as
+ * nothing else matches it, so most are never read at all.
+ * There is no hash of the whole content: the last stage
+ * reads the members of a group side by side and compares
+ * them with the first, so each is read whole just once and
+ * a match is certain. The partial hashes are read over the
+ * pool in device and inode order, for locality; the
+ * compares go group by group.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+#include "pool.h"
+
+/* Bytes hashed at each end of a file for the partial hash. */
+#define DUPES_EDGE_LENGTH 4096
+
+#define DUPES_READ_LENGTH (256 * 1024)
+
+#define DUPES_SEED 0x6475706573000001ULL
+
+/* Files compared at once with the first of a group. */
+#define DUPES_BATCH 64
+
+struct file {
+    struct entry *e;
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;            // In bytes
+    uint64_t partial;
+    size_t same;              // Index + 1 of the file it equals
+    int failed;               // Could not be read
+};
+
+static struct file *files = 0;
+static size_t n_files = 0;
+static size_t n_failed = 0;
+
+static size_t *group_starts = 0; // Into files, for the compare stage
+
+static void stat_range(size_t start, size_t end, void *arg) {
+    char path[DU_PATH_MAX + 1];
+    struct stat st;
+
+    for (size_t i = start; i < end; i++) {
+        struct file *f = &files[i];
+        f->failed = 0;
+        f->size = 0;
+        if (!entry_path(f->e, path, sizeof(path)) || lstat(path, &st) == -1) {
+            f->failed = 1;
+            continue;
+        }
+        /* Empty directories are leaves too; size 0 drops them. */
+        if (!S_ISREG(st.st_mode))
+            continue;
+        f->dev = st.st_dev;
+        f->ino = st.st_ino;
+        f->size = st.st_size;
+    }
+}
+
+static int open_file(struct file *f) {
+    char path[DU_PATH_MAX + 1];
+
+    if (!entry_path(f->e, path, sizeof(path)))
+        return -1;
+    return open(path, O_RDONLY);
+}
+
+/* Read exactly n bytes at offset, or fail. */
+static int read_at(int fd, char *buf, size_t n, off_t offset) {
+    while (n > 0) {
+        ssize_t r = pread(fd, buf, n, offset);
+        if (r == -1 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        buf += r;
+        n -= r;
+        offset += r;
+    }
+    return 0;
+}
+
+/* Hash the first and last blocks; all of a small file. */
+static void partial_range(size_t start, size_t end, void *arg) {
+    char buf[2 * DUPES_EDGE_LENGTH];
+
+    for (size_t i = start; i < end; i++) {
+        struct file *f = &files[i];
+        int fd = open_file(f);
+        if (fd == -1) {
+            f->failed = 1;
+            continue;
+        }
+
+        size_t n;
+        int r;
+        if (f->size <= sizeof(buf)) {
+            n = f->size;
+            r = read_at(fd, buf, n, 0);
+        } else {
+            n = sizeof(buf);
+            r = read_at(fd, buf, DUPES_EDGE_LENGTH, 0);
+            if (r == 0)
+                r = read_at(fd, buf + DUPES_EDGE_LENGTH, DUPES_EDGE_LENGTH,
+                            f->size - DUPES_EDGE_LENGTH);
+        }
+        close(fd);
+        if (r == -1) {
+            f->failed = 1;
+            continue;
+        }
+        f->partial = hash64(buf, n, DUPES_SEED);
+    }
+}
+
+/*
+ * Compare the n files in batch with files[rep] block by
+ * block, reading each of them once, and mark those with the
+ * same bytes as equal to it. One that cannot be read is
+ * marked failed, and settled, so it is not tried again.
+ */
+static void compare_batch(size_t rep, size_t *batch, int n, char *buf) {
+    struct file *r = &files[rep];
+    int fds[DUPES_BATCH];
+    int fd = open_file(r);
+
+    if (fd == -1) {
+        r->failed = 1;
+        return;
+    }
+    for (int k = 0; k < n; k++) {
+        struct file *f = &files[batch[k]];
+        fds[k] = open_file(f);
+        if (fds[k] == -1) {
+            f->failed = 1;
+            f->same = batch[k] + 1;
+        }
+    }
+
+    int n_live = n;
+    for (uint64_t offset = 0; n_live > 0 && offset < r->size; ) {
+        size_t len = r->size - offset < DUPES_READ_LENGTH ?
+            r->size - offset : DUPES_READ_LENGTH;
+        if (read_at(fd, buf, len, offset) == -1) {
+            r->failed = 1;
+            break;
+        }
+        for (int k = 0; k < n; k++) {
+            if (fds[k] == -1)
+                continue;
+            struct file *f = &files[batch[k]];
+            char *other = buf + DUPES_READ_LENGTH;
+            int bad = read_at(fds[k], other, len, offset) == -1;
+            if (bad || memcmp(buf, other, len)) {
+                if (bad) {
+                    f->failed = 1;
+                    f->same = batch[k] + 1;
+                }
+                close(fds[k]);
+                fds[k] = -1;
+                n_live--;
+            }
+        }
+        offset += len;
+    }
+
+    for (int k = 0; k < n; k++) {
+        if (fds[k] == -1)
+            continue;
+        if (!r->failed)
+            files[batch[k]].same = rep + 1;
+        close(fds[k]);
+    }
+    close(fd);
+}
+
+/*
+ * Split each group of equal partial hashes by content. The
+ * first file not yet placed is compared with the rest of
+ * the unplaced ones; almost always that places them all.
+ */
+static void compare_range(size_t start, size_t end, void *arg) {
+    char *buf = mem_malloc(MEM_INPUT, 2 * DUPES_READ_LENGTH);
+    size_t batch[DUPES_BATCH];
+
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (size_t g = start; g < end; g++) {
+        size_t first = group_starts[g], last = group_starts[g + 1];
+        for (size_t i = first; i < last; i++)
+            files[i].same = 0;
+        for (size_t i = first; i < last; i++) {
+            if (files[i].same)
+                continue;
+            files[i].same = i + 1;
+            for (size_t j = i + 1; j < last && !files[i].failed; ) {
+                int n = 0;
+                for (; j < last && n < DUPES_BATCH; j++)
+                    if (!files[j].same)
+                        batch[n++] = j;
+                if (n == 0)
+                    break;
+                compare_batch(i, batch, n, buf);
+            }
+        }
+    }
+    mem_free(MEM_INPUT, buf);
+}
+
+static int compare_inodes(const void *p1, const void *p2) {
+    const struct file *f1 = p1;
+    const struct file *f2 = p2;
+
+    if (f1->dev != f2->dev)
+        return f1->dev < f2->dev ? -1 : 1;
+    if (f1->ino != f2->ino)
+        return f1->ino < f2->ino ? -1 : 1;
+    return 0;
+}
+
+static int compare_sizes(const void *p1, const void *p2) {
+    const struct file *f1 = p1;
+    const struct file *f2 = p2;
+
+    if (f1->size != f2->size)
+        return f1->size < f2->size ? -1 : 1;
+    return 0;
+}
+
+static int compare_partials(const void *p1, const void *p2) {
+    const struct file *f1 = p1;
+    const struct file *f2 = p2;
+    int q = compare_sizes(p1, p2);
+
+    if (q != 0)
+        return q;
+    if (f1->partial != f2->partial)
+        return f1->partial < f2->partial ? -1 : 1;
+    return 0;
+}
+
+static int compare_same(const void *p1, const void *p2) {
+    const struct file *f1 = p1;
+    const struct file *f2 = p2;
+    int q = compare_partials(p1, p2);
+
+    if (q != 0)
+        return q;
+    if (f1->same != f2->same)
+        return f1->same < f2->same ? -1 : 1;
+    return 0;
+}
+
+/* Drop the files that failed, and empty ones. */
+static void drop_failed(void) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < n_files; i++) {
+        if (files[i].failed)
+            n_failed++;
+        else if (files[i].size > 0)
+            files[n++] = files[i];
+    }
+    n_files = n;
+}
+
+/*
+ * Sort by compare and keep only the files that have at
+ * least one match, leaving them grouped.
+ */
+static void keep_matches(int (*compare)(const void *, const void *)) {
+    size_t n = 0;
+    int before = 0;
+
+    /* Compare ahead of the compaction, which overwrites behind. */
+    pool_sort(files, n_files, sizeof(files[0]), compare);
+    for (size_t i = 0; i < n_files; i++) {
+        int after = i + 1 < n_files && !compare(&files[i], &files[i + 1]);
+        if (before || after)
+            files[n++] = files[i];
+        before = after;
+    }
+    n_files = n;
+}
+
+/* Only one name of a multiply-linked file is kept. */
+static void drop_links(void) {
+    size_t n = 0;
+
+    pool_sort(files, n_files, sizeof(files[0]), compare_inodes);
+    for (size_t i = 0; i < n_files; i++)
+        if (i == 0 || compare_inodes(&files[i - 1], &files[i]))
+            files[n++] = files[i];
+    n_files = n;
+}
+
+/* Run a read stage over the candidates in inode order. */
+static void read_stage(void (*fn)(size_t start, size_t end, void *arg)) {
+    pool_sort(files, n_files, sizeof(files[0]), compare_inodes);
+    pool_for(0, n_files, 0, fn, 0);
+    drop_failed();
+}
+
+void find_dupes(void) {
+    for (int i = 0; i < n_entries; i++)
+        if (entries[i].n_children == 0)
+            n_files++;
+
+    files = mem_malloc(MEM_INPUT, n_files * sizeof(files[0]) + 1);
+    if (!files) {
+        perror("malloc");
+        exit(1);
+    }
+    n_files = 0;
+    for (int i = 0; i < n_entries; i++)
+        if (entries[i].n_children == 0)
+            files[n_files++].e = &entries[i];
+
+    pool_for(0, n_files, 0, stat_range, 0);
+    drop_failed();
+    drop_links();
+
+    size_t n_candidates = n_files;
+
+    keep_matches(compare_sizes);
+    size_t n_partial = n_files;
+    read_stage(partial_range);
+    keep_matches(compare_partials);
+
+    /* The partial hash only nominates; the bytes decide. */
+    size_t n_compared = n_files, n_groups = 0;
+    group_starts = mem_malloc(MEM_INPUT,
+                              (n_files + 1) * sizeof(group_starts[0]));
+    if (!group_starts) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < n_files; i++)
+        if (i == 0 || compare_partials(&files[i - 1], &files[i]))
+            group_starts[n_groups++] = i;
+    group_starts[n_groups] = n_files;
+    pool_for(0, n_groups, 0, compare_range, 0);
+    mem_free(MEM_INPUT, group_starts);
+    drop_failed();
+    keep_matches(compare_same);
+
+    fprintf(stderr, "dupes: %zu files, %zu read in part, %zu compared\n",
+            n_candidates, n_partial, n_compared);
+}
+
+struct group {
+    size_t first, n;
+    uint64_t wasted;
+};
+
+static int compare_files(const void *p1, const void *p2) {
+    const struct file *f1 = p1;
+    const struct file *f2 = p2;
+
+    return f1->e < f2->e ? -1 : f1->e > f2->e;
+}
+
+static int compare_groups(const void *p1, const void *p2) {
+    const struct group *g1 = p1;
+    const struct group *g2 = p2;
+
+    if (g1->wasted != g2->wasted)
+        return g1->wasted > g2->wasted ? -1 : 1;
+    return g1->first < g2->first ? -1 : 1;
+}
+
+/* List the groups found by find_dupes(), most wasteful first. */
+void show_dupes(FILE *out) {
+    struct group *groups = mem_malloc(MEM_OUTPUT,
+                                      n_files * sizeof(groups[0]) + 1);
+    size_t n_groups = 0;
+    uint64_t total = 0;
+
+    if (!groups) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < n_files; ) {
+        size_t j = i + 1;
+        while (j < n_files && !compare_same(&files[i], &files[j]))
+            j++;
+        /* Members in input order. */
+        qsort(&files[i], j - i, sizeof(files[0]), compare_files);
+        groups[n_groups].first = i;
+        groups[n_groups].n = j - i;
+        groups[n_groups].wasted = files[i].size * (j - i - 1);
+        total += groups[n_groups].wasted;
+        n_groups++;
+        i = j;
+    }
+    qsort(groups, n_groups, sizeof(groups[0]), compare_groups);
+
+    fprintf(out, "\nduplicates: %zu groups, %" PRIu64 " bytes wasted\n",
+            n_groups, total);
+    for (size_t k = 0; k < n_groups; k++) {
+        struct group *g = &groups[k];
+        char path[DU_PATH_MAX + 1];
+        fprintf(out, "%" PRIu64 " wasted: %zu x %" PRIu64 "\n",
+                g->wasted, g->n, files[g->first].size);
+        for (size_t i = g->first; i < g->first + g->n; i++)
+            fprintf(out, "  %s\n",
+                    entry_path(files[i].e, path, sizeof(path)));
+    }
+    if (n_failed > 0)
+        fprintf(stderr, "warning: %zu files could not be read\n", n_failed);
+    mem_free(MEM_OUTPUT, groups);
+}
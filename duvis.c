@@ -6,6 +6,8 @@
  */ 
    
 /* ASCII xdu replacement with reasonable performance. */
+
+#define _XOPEN_SOURCE 700
  
 #include <assert.h>
 #include <ctype.h>
@@ -19,129 +21,173 @@
 #include <getopt.h>
 
 #include "duvis.h"
+#include "hash.h"
+#include "mem.h"
 #include "pathmem.h"
+#include "pool.h"
 
 #define IO_BUFFER_LENGTH (1024 * 1024)
 
+#define NODE_ID_SEED 0x6e6f646569640001ULL
+
 int n_entries = 0;
 struct entry *entries = 0;
 struct entry *root_entry;
 int base_depth = 0;	/* Component length of initial prefix */
 
-static void read_entries(FILE *f, int zeroflag) {
-    int max_entries = 0;
-    int line_number = 0;
-    
-    while (1) {
-        /* Get a buffer for the line data. */
-        char *path = path_alloc();
-
-        if (!path) {
-            perror("malloc");
+static int max_entries = 0;	/* Allocated length of entries */
+
+/* Get a fresh slot at the end of the entry table. */
+struct entry *new_entry(void) {
+    while (n_entries >= max_entries) {
+        int old_max = max_entries;
+        if (max_entries == 0)
+            max_entries = DU_INIT_ENTRIES_SIZE;
+        else
+            max_entries *= 2;
+        entries = mem_realloc(MEM_ENTRIES, entries,
+                              max_entries * sizeof(entries[0]));
+        if (!entries) {
+            perror("realloc");
             exit(1);
         }
+        mem_slack(MEM_ENTRIES, (max_entries - old_max) * sizeof(entries[0]));
+    }
 
-        /* Read the next line. */
-        path[DU_BUFFER_LENGTH - 1] = '\0';
-        errno = 0;
+    mem_slack(MEM_ENTRIES, -(int64_t) sizeof(entries[0]));
+    struct entry *entry = &entries[n_entries++];
+    entry->n_children = 0;
+    entry->n_chain = 0;
+    entry->children = 0;
+    return entry;
+}
 
-       int nchars = path_get(path, DU_BUFFER_LENGTH, f ,zeroflag);
+/* Give back the unused tail of the entry table. */
+void trim_entries(void) {
+    mem_slack(MEM_ENTRIES,
+              -(int64_t) ((max_entries - n_entries) * sizeof(entries[0])));
+    max_entries = n_entries;
+    entries = mem_realloc(MEM_ENTRIES, entries,
+                          max_entries * sizeof(entries[0]));
 
-        if (nchars == -1)
-            fprintf(stderr, "line %d: path buffer overrun\n", line_number + 1);
+    if (!entries) {
+        perror("realloc");
+        exit(1);
+    }
+}
 
-        if (nchars == 0) {
-            entries = realloc(entries, n_entries * sizeof(entries[0]));
-            
-            if (!entries) {
-                perror("realloc");
-                exit(1);
-            }
-            return;
-        }
+/* Parse the size and components out of the line in entry->path. */
+void parse_entry(struct entry *entry, int line_number) {
+    char *path = entry->path;
 
-        line_number++;
-
-        /* Allocate a new entry for the line. */
-        while (n_entries >= max_entries) {
-            if (max_entries == 0)
-                max_entries = DU_INIT_ENTRIES_SIZE;
-            else
-                max_entries *= 2;
-            entries = realloc(entries, max_entries * sizeof(entries[0]));
-            if (!entries) {
-                perror("realloc");
-                exit(1);
-            }
-        }
+    /* Start to parse the line. */
+    char *index = path;
 
-        struct entry *entry = &entries[n_entries++];
-        entry->path = path;
-        entry->n_children = 0;
-        entry->children = 0;
+    while (isdigit(*index))
+        index++;
 
-        /* Start to parse the line. */
-        char *index = path;
+    if (index == path || (*index != ' ' && *index != '\t')) {
+        fprintf(stderr, "line %d: buffer format error\n", line_number);
+        exit(1);
+    }
 
-        while (isdigit(*index))
-            index++;
+    /* Parse the size field. */
+    *index++ = '\0';
+    int n_scanned = sscanf(path, "%" PRIu64, &entry->size);  //Should be: PRIu64
 
-        if (index == path || (*index != ' ' && *index != '\t')) {
-            fprintf(stderr, "line %d: buffer format error\n", line_number);
-            exit(1);
-        }
+    if (n_scanned != 1) {
+        fprintf(stderr, "line %d: size parse failure\n", line_number);
+        exit(1);
+    }
 
-        /* Parse the size field. */
-        *index++ = '\0';
-        int n_scanned = sscanf(path, "%" PRIu64, &entry->size);  //Should be: PRIu64
+    /*
+     * Parse the path. Note that we don't skip extra separator
+     * chars, on the off chance that there's a leading path that
+     * starts with a whitespace character.
+     */
+    entry->components =
+        mem_malloc(MEM_COMPONENTS,
+                   DU_COMPONENTS_MAX * sizeof(entry->components[0]));
 
-        if (n_scanned != 1) {
-            fprintf(stderr, "line %d: size parse failure\n", line_number);
-            exit(1);
-        }
+    if (!entry->components) {
+        perror("malloc");
+        exit(1);
+    }
 
-        /*
-         * Parse the path. Note that we don't skip extra separator
-         * chars, on the off chance that there's a leading path that
-         * starts with a whitespace character.
-         */
-        entry->components =
-            malloc(DU_COMPONENTS_MAX * sizeof(entry->components[0]));
+    entry->components[0] = index;
+    entry->n_components = 1;
 
-        if (!entry->components) {
-            perror("malloc");
-            exit(1);
+    while (1) {
+        if (*index == '\n' || *index == '\0') {
+            *index = '\0';
+            break;
         }
+        else if (*index == '/') {
+            *index++ = '\0';
+            entry->components[entry->n_components++] = index;
+            assert(entry->n_components < DU_COMPONENTS_MAX);
+        }
+        else {
+            index++;
+        }
+    }
 
-        entry->components[0] = index;
-        entry->n_components = 1;
+    /* Don't leak a ton of data on each entry. */
+    entry->components =
+        mem_realloc(MEM_COMPONENTS, entry->components,
+                entry->n_components * sizeof(entry->components[0]));
 
-        while (1) {
-            if (*index == '\n' || *index == '\0') {
-                *index = '\0';
-                break;
-            }
-            else if (*index == '/') {
-                *index++ = '\0';
-                entry->components[entry->n_components++] = index;
-                assert(entry->n_components < DU_COMPONENTS_MAX);
-            }
-            else {
-                index++;
-            }
-        }
+    if (!entry->components) {
+        perror("realloc");
+        exit(1);
+    }
+}
 
-        /* Don't leak a ton of data on each entry. */
-        entry->components =
-            realloc(entry->components,
-                    entry->n_components * sizeof(entry->components[0]));
+/* Add an entry for an in-memory du line of nchars characters. */
+struct entry *add_line(const char *line, int nchars, int line_number) {
+    char *path = path_copy(line, nchars);
 
-        if (!entry->components) {
-            perror("realloc");
-            exit(1);
-        }
+    if (!path) {
+        fprintf(stderr, "line %d: path buffer overrun\n", line_number);
+        exit(1);
     }
-    assert(0);
+
+    struct entry *entry = new_entry();
+    entry->path = path;
+    parse_entry(entry, line_number);
+    return entry;
+}
+
+/*
+ * Add an already-parsed entry. The components are stored
+ * back to back, each terminated by a null, in len bytes.
+ */
+struct entry *add_parsed(uint64_t size, uint32_t n_components,
+                         const char *components, int len) {
+    char *path = path_copy(components, len);
+
+    if (!path || n_components == 0) {
+        fprintf(stderr, "entry %d: malformed parsed entry\n", n_entries + 1);
+        exit(1);
+    }
+
+    struct entry *entry = new_entry();
+    entry->path = path;
+    entry->size = size;
+    entry->n_components = n_components;
+    entry->components =
+        mem_malloc(MEM_COMPONENTS, n_components * sizeof(entry->components[0]));
+
+    if (!entry->components) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < n_components; i++) {
+        entry->components[i] = path;
+        path += strlen(path) + 1;
+    }
+    return entry;
 }
 
 /*
@@ -204,149 +250,586 @@ int compare_subtrees(const void *p1, const void * p2) {
 }
 
 /*
- * Build a tree in the entry structure. This implementation
- * utilizes post-order traversal and takes advantage of the
- * existing du sorted output - assumes user wants du output
+ * True if p is the parent of e. Components are stored back
+ * to back, each terminated by a null, so this is one compare.
  */
- 
-void build_tree_postorder(uint32_t start, uint32_t end, uint32_t depth) {
-    
-    /* Set up for calculation */
-    struct entry *e = &entries[start];
-    uint32_t offset = 0;
+static int is_parent(struct entry *p, struct entry *e) {
+    uint32_t n = p->n_components;
+    const char *last = p->components[n - 1];
+    size_t len = last + strlen(last) + 1 - p->components[0];
+
+    return e->n_components == n + 1 &&
+           e->components[n] == e->components[0] + len &&
+           !memcmp(p->components[0], e->components[0], len);
+}
 
-    e->depth = depth;
-    e->n_children = 0;
-
-    /* Find a subtree */
-    int i = start;
-    while(i < end) {
-        
-        int j = i + 1;
-  
-        offset = entries[i].n_components - 2;
-
-        /* Go to the end of this subtree */
-        while(j < end && entries[j].n_components < offset &&
-                !strcmp(entries[i].components[offset], 
-                        entries[j].components[offset]))
-        {
-            entries[j].n_children++;
-            j++;
+/*
+ * Postorder builder state. du emits each directory after
+ * everything below it, so entries wait on a stack until
+ * their parent arrives and pops them. Children are kept as
+ * indices until the end, because the entry table may still
+ * move as it grows.
+ */
+static uint32_t *waiting;     // Entries whose parent has not arrived
+static uint32_t n_waiting, max_waiting;
+static uint32_t *child_index; // Children of each entry, contiguous
+static uint32_t n_child_index, max_child_index;
+static uint32_t *child_offset; // Start of each entry's children
+static uint32_t max_child_offset;
+
+static void *grow(void *p, uint32_t *max, uint32_t need, size_t size) {
+    if (need <= *max)
+        return p;
+    while (*max < need)
+        *max = *max ? 2 * *max : 1024;
+    p = mem_realloc(MEM_CHILDREN, p, *max * size);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * Attach entries[i], which has just been read, to the
+ * tree: it adopts every waiting entry below it. This can
+ * run as the entries stream in.
+ */
+void postorder_add(int i) {
+    uint32_t k = entries[i].n_components;
+    uint32_t start = n_child_index;
+
+    while (n_waiting > 0 &&
+           entries[waiting[n_waiting - 1]].n_components > k) {
+        uint32_t c = waiting[--n_waiting];
+        if (!is_parent(&entries[i], &entries[c])) {
+            fprintf(stderr, "index %u: missing entry\n", c + 1);
+            exit(1);
         }
+        child_index = grow(child_index, &max_child_index,
+                           n_child_index + 1, sizeof(child_index[0]));
+        child_index[n_child_index++] = c;
+    }
 
-        /* If we found a subtree then let's build it */
-        if(j > i + 1)
-            build_tree_postorder(i + 1,  j, entries[i].n_components - 1);
-   
-        /* Allocate memory for children */
-        entries[j].children = malloc(entries[j].n_children * sizeof(entries[j].children[0]));
-    
-        /* Fill direct children */
-        int n_children = 0;
-        for(int k = i; k < j; k++)
-            if(entries[k].n_components == offset + 2)
-                entries[j].children[n_children++] = &entries[k];
+    child_offset = grow(child_offset, &max_child_offset,
+                        i + 1, sizeof(child_offset[0]));
+    child_offset[i] = start;
+    entries[i].n_children = n_child_index - start;
 
-        i = j;
+    waiting = grow(waiting, &max_waiting, n_waiting + 1,
+                   sizeof(waiting[0]));
+    waiting[n_waiting++] = i;
+}
 
-        /* Ensure that the children have been allocated appropriately */
-        //assert(n_children == entries[j].n_children);
+/* Once all entries are in, turn the indices into the tree. */
+void postorder_finish(void) {
+    if (n_waiting == 0) {
+        fprintf(stderr, "no entries\n");
+        exit(1);
+    }
+    if (n_waiting != 1) {
+        fprintf(stderr, "index %u: unexpected entry\n", waiting[1] + 1);
+        exit(1);
     }
+
+    root_entry = &entries[waiting[0]];
+    base_depth = root_entry->n_components;
+
+    struct entry **pool =
+        mem_malloc(MEM_CHILDREN, n_child_index * sizeof(pool[0]) + 1);
+    if (!pool) {
+        perror("malloc");
+        exit(1);
+    }
+    for (uint32_t j = 0; j < n_child_index; j++)
+        pool[j] = &entries[child_index[j]];
+
+    for (int i = 0; i < n_entries; i++) {
+        entries[i].children = &pool[child_offset[i]];
+        entries[i].depth = entries[i].n_components - base_depth;
+    }
+
+    mem_free(MEM_CHILDREN, waiting);
+    mem_free(MEM_CHILDREN, child_index);
+    mem_free(MEM_CHILDREN, child_offset);
+    waiting = child_index = child_offset = 0;
+    n_waiting = max_waiting = 0;
+    n_child_index = max_child_index = max_child_offset = 0;
 }
 
 /*
- * Build a tree in the entry structure. The three-pass design
- * is for monotonic malloc() usage, because efficiency.
+ * Build a tree in the entry structure from du's own
+ * postorder, in one linear scan.
  */
-void build_tree_preorder(uint32_t start, uint32_t end, uint32_t depth) {
-    
-    /* Set up for calculation. */
-    struct entry *e = &entries[start];
-    uint32_t offset = depth + base_depth;
-    if (e->n_components != offset) {
-        fprintf(stderr, "index %d: unexpected entry\n", start + 1);
-        exit(1);
-    }
-    e->depth = depth;
+void build_tree_postorder(void) {
+    for (int i = 0; i < n_entries; i++)
+        postorder_add(i);
+    postorder_finish();
+}
 
-    /* Pass 1: Count and allocate direct children. */
-    for (int i = start + 1; i < end; i++)
-        if (entries[i].n_components == offset + 1)
-            e->n_children++;
-    e->children = malloc(e->n_children * sizeof(e->children[0]));
-    if (!e->children) {
+/*
+ * Close the open entry e whose children are the top of the
+ * scratch stack from mark up, moving them into the children
+ * pool.
+ */
+static void close_entry(struct entry *e, struct entry **scratch,
+                        uint32_t *n_scratch, uint32_t mark,
+                        struct entry **pool, uint32_t *n_pool) {
+    e->n_children = *n_scratch - mark;
+    e->children = &pool[*n_pool];
+    memcpy(e->children, &scratch[mark],
+           e->n_children * sizeof(e->children[0]));
+    *n_pool += e->n_children;
+    *n_scratch = mark;
+}
+
+/*
+ * Build a tree in the entry structure. Sorted entries are a
+ * preorder walk of the tree, so a single scan with a stack
+ * of the open ancestors at each depth finds every parent
+ * with one compare to check it. Children collect on a
+ * scratch stack until their parent is closed, and then move
+ * into one pool shared by the whole tree, because efficiency.
+ */
+void build_tree_preorder(void) {
+    static struct entry *open[DU_COMPONENTS_MAX];
+    static uint32_t mark[DU_COMPONENTS_MAX];
+    struct entry **scratch =
+        mem_malloc(MEM_CHILDREN, n_entries * sizeof(scratch[0]));
+    struct entry **pool = mem_malloc(MEM_CHILDREN, n_entries * sizeof(pool[0]));
+    uint32_t n_scratch = 0, n_pool = 0;
+
+    if (!scratch || !pool) {
         perror("malloc");
         exit(1);
     }
 
-    /* Pass 2: Fill direct children and build subtrees. */
-    int n_children = 0;
-    int i = start + 1;
-    while (i < end) {
-        if (entries[i].n_components != offset + 1) {
+    /* The root is open at depth 0. */
+    uint32_t depth = 0;
+    open[0] = &entries[0];
+    mark[0] = 0;
+    entries[0].depth = 0;
+
+    for (int i = 1; i < n_entries; i++) {
+        struct entry *e = &entries[i];
+        uint32_t d = e->n_components - base_depth;
+
+        if (e->n_components <= base_depth) {
+            fprintf(stderr, "index %d: unexpected entry\n", i + 1);
+            exit(1);
+        }
+        if (d > depth + 1) {
+            fprintf(stderr, "index %d: missing entry\n", i + 1);
+            exit(1);
+        }
+
+        /* Close everything that is not an ancestor of e. */
+        while (depth >= d) {
+            close_entry(open[depth], scratch, &n_scratch, mark[depth],
+                        pool, &n_pool);
+            depth--;
+        }
+
+        /* The components of e's parent must be a prefix of its own. */
+        if (!is_parent(open[d - 1], e)) {
             fprintf(stderr, "index %d: missing entry\n", i + 1);
             exit(1);
         }
-        e->children[n_children++] = &entries[i];
-        entries[i].depth = depth + 1;
-        int j = i + 1;
-        /* Walk to end of subtree. */
-        while (j < end && entries[j].n_components > offset + 1 &&
-               !strcmp(entries[i].components[offset],
-                       entries[j].components[offset]))
-            j++;
-        /* If subtree is found, build it. */
-        if (j > i + 1)
-            build_tree_preorder(i, j, depth + 1);
-        i = j;
-    }
-    assert(n_children == e->n_children);
-    /* Pass 3: Sort the children. Should this be here or in display? */
-    qsort(e->children, e->n_children, sizeof(e->children[0]),
-          compare_subtrees);
-}
-
-void indent(uint32_t depth) {
+
+        /* e is a child of open[d - 1] and is now open itself. */
+        e->depth = d;
+        scratch[n_scratch++] = e;
+        open[d] = e;
+        mark[d] = n_scratch;
+        depth = d;
+    }
+
+    while (1) {
+        close_entry(open[depth], scratch, &n_scratch, mark[depth],
+                    pool, &n_pool);
+        if (depth == 0)
+            break;
+        depth--;
+    }
+    assert(n_scratch == 0 && n_pool == n_entries - 1);
+    mem_free(MEM_CHILDREN, scratch);
+}
+
+static void sort_range(size_t start, size_t end, void *arg) {
+    for (size_t i = start; i < end; i++)
+        qsort(entries[i].children, entries[i].n_children,
+              sizeof(entries[i].children[0]), compare_subtrees);
+}
+
+/* Order every entry's children for display, in parallel. */
+void sort_children(void) {
+    pool_for(0, n_entries, 0, sort_range, 0);
+}
+
+void indent(FILE *out, uint32_t depth) {
     for (uint64_t i = 0; i < N_INDENT * depth; i++)
-        putchar(' ');
+        putc(' ', out);
+}
+
+/* Levels near the root whose subtrees are processed in parallel. */
+#define PARALLEL_LEVELS 3
+
+struct child_work {
+    struct entry *e;
+    uint32_t depth;
+    void (*fn)(struct entry *e, uint32_t depth);
+};
+
+static void child_range(size_t start, size_t end, void *arg) {
+    struct child_work *w = arg;
+    for (size_t i = start; i < end; i++)
+        w->fn(w->e->children[i], w->depth);
 }
 
-void show_entries(struct entry *e) {
-    uint32_t depth = e->depth;
-    if (depth == 0) {
-        printf("%s", e->components[0]);
-        for (uint32_t i = 1; i < base_depth; i++)
-            printf("/%s", e->components[i]);
-        printf(" %"PRIu64 "\n", e->size);
+/* Apply fn to each child of e, in parallel near the root. */
+static void for_children(struct entry *e, uint32_t depth,
+                         void (*fn)(struct entry *e, uint32_t depth)) {
+    struct child_work w = {e, depth, fn};
+
+    if (depth <= PARALLEL_LEVELS)
+        pool_for(0, e->n_children, 1, child_range, &w);
+    else
+        child_range(0, e->n_children, &w);
+}
+
+static void collapse_subtree(struct entry *e, uint32_t depth) {
+    for_children(e, depth + 1, collapse_subtree);
+    e->n_chain = e->n_children == 1 ? e->children[0]->n_chain + 1 : 0;
+}
+
+/*
+ * Record in each entry how many single-child levels below
+ * it are folded into it for display. Bottom-up, so each
+ * chain is found once.
+ */
+void collapse_chains(struct entry *e) {
+    collapse_subtree(e, 0);
+}
+
+/* The entry at the bottom of the chain folded into e. */
+struct entry *chain_end(struct entry *e) {
+    while (e->n_chain > 0)
+        e = e->children[0];
+    return e;
+}
+
+/* Write e's full path into buf, or return 0 if it is too long. */
+char *entry_path(struct entry *e, char *buf, size_t n) {
+    size_t len = 0;
+
+    for (uint32_t i = 0; i < e->n_components; i++) {
+        size_t c = strlen(e->components[i]);
+        if (len + c + 2 > n)
+            return 0;
+        if (i > 0)
+            buf[len++] = '/';
+        memcpy(buf + len, e->components[i], c);
+        len += c;
     }
-    else {
-        indent(depth);
-        printf("%s %"PRIu64"\n",
-               e->components[e->n_components - 1], e->size);
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * Write the name shown for e at depth into buf: the last
+ * component, joined with the rest of any chain folded into
+ * e, or the whole path at the root. Return 0 if too long.
+ */
+char *chain_name(struct entry *e, uint32_t depth, char *buf, size_t n) {
+    struct entry *end = chain_end(e);
+    uint32_t first = depth > 0 ? e->n_components - 1 : 0;
+    size_t len = 0;
+
+    for (uint32_t i = first; i < end->n_components; i++) {
+        size_t c = strlen(end->components[i]);
+        if (len + c + 2 > n)
+            return 0;
+        if (i > first)
+            buf[len++] = '/';
+        memcpy(buf + len, end->components[i], c);
+        len += c;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * Stable ID of a path: a hash of its nonempty components,
+ * so that a path has the same ID in every capture.
+ */
+uint64_t path_id(const char *path) {
+    uint64_t h = NODE_ID_SEED;
+
+    while (*path) {
+        size_t len = strcspn(path, "/");
+        if (len > 0)
+            h = hash64(path, len, h);
+        path += len + (path[len] == '/');
+    }
+    return h;
+}
+
+/* The same, from e's components. */
+uint64_t entry_id(struct entry *e) {
+    uint64_t h = NODE_ID_SEED;
+
+    for (uint32_t i = 0; i < e->n_components; i++)
+        if (e->components[i][0])
+            h = hash64(e->components[i], strlen(e->components[i]), h);
+    return h;
+}
+
+/* Extra column after each label in the text tree, if set. */
+void (*show_extra)(FILE *out, struct entry *e) = 0;
+
+/* Show each directory's own counts, for --count-inodes. */
+int dir_counts = 0;
+
+/*
+ * The number of names directly in the directory at the end
+ * of e's chain: its count less itself and its children's,
+ * plus one name for each child. Subdirectories go in
+ * *subdirs. Only meaningful when sizes count names.
+ */
+uint64_t dir_entries(struct entry *e, uint32_t *subdirs) {
+    struct entry *end = chain_end(e);
+    uint64_t n = end->size - 1 + end->n_children;
+
+    for (uint32_t i = 0; i < end->n_children; i++)
+        n -= end->children[i]->size;
+    *subdirs = end->n_children;
+    return n;
+}
+
+static void show_counts(FILE *out, struct entry *e) {
+    uint32_t subdirs;
+    uint64_t n = dir_entries(e, &subdirs);
+
+    fprintf(out, " (%" PRIu64 " entries, %" PRIu32 " subdirs)", n, subdirs);
+}
+
+static void show_label(FILE *out, struct entry *e, uint32_t depth) {
+    struct entry *end = chain_end(e);
+    uint32_t first = 0;
+
+    /* Show the whole prefix at the root. */
+    if (depth > 0) {
+        for (uint64_t i = 0; i < N_INDENT * depth; i++)
+            putc(' ', out);
+        first = e->n_components - 1;
+    }
+    fputs(end->components[first], out);
+    for (uint32_t i = first + 1; i < end->n_components; i++) {
+        putc('/', out);
+        fputs(end->components[i], out);
+    }
+    fprintf(out, " %"PRIu64, e->size);
+    if (show_extra)
+        show_extra(out, e);
+    putc('\n', out);
+}
+
+void show_entries(FILE *out, struct entry *e, uint32_t depth) {
+    struct entry *end = chain_end(e);
+
+    show_label(out, e, depth);
+    for (uint32_t i = 0; i < end->n_children; i++)
+        show_entries(out, end->children[i], depth + 1);
+}
+
+/*
+ * A piece of the text tree: either one label or a whole
+ * subtree, formatted into memory.
+ */
+struct segment {
+    struct entry *e;
+    uint32_t depth;
+    int whole;
+    char *text;
+    size_t length;
+};
+
+struct segments {
+    struct segment *s;
+    size_t n, max;
+};
+
+/* List segments in output order, splitting the top levels. */
+static void add_segments(struct segments *segs, struct entry *e,
+                         uint32_t depth) {
+    if (segs->n >= segs->max) {
+        segs->max = segs->max ? 2 * segs->max : 1024;
+        segs->s = mem_realloc(MEM_OUTPUT, segs->s,
+                              segs->max * sizeof(segs->s[0]));
+        if (!segs->s) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    struct segment *seg = &segs->s[segs->n++];
+    seg->e = e;
+    seg->depth = depth;
+    seg->whole = depth >= PARALLEL_LEVELS;
+    if (seg->whole)
+        return;
+
+    struct entry *end = chain_end(e);
+    for (uint32_t i = 0; i < end->n_children; i++)
+        add_segments(segs, end->children[i], depth + 1);
+}
+
+static void format_range(size_t start, size_t end, void *arg) {
+    struct segment *s = arg;
+
+    for (size_t i = start; i < end; i++) {
+        FILE *mem = open_memstream(&s[i].text, &s[i].length);
+        if (!mem) {
+            perror("open_memstream");
+            exit(1);
+        }
+        if (s[i].whole)
+            show_entries(mem, s[i].e, s[i].depth);
+        else
+            show_label(mem, s[i].e, s[i].depth);
+        fclose(mem);
     }
-    for (uint32_t i = 0; i < e->n_children; i++)
-        show_entries(e->children[i]);
 }
 
-void show_entries_raw(struct entry e[], int n) {
+/*
+ * Emit the text tree. With more than one thread, the
+ * subtrees below the top levels are formatted in parallel
+ * a window at a time and written out in order.
+ */
+void show_tree(FILE *out, struct entry *root) {
+    if (pool_threads == 1) {
+        show_entries(out, root, 0);
+        return;
+    }
+
+    struct segments segs = {0, 0, 0};
+    add_segments(&segs, root, 0);
+
+    size_t window = 16 * pool_threads;
+    for (size_t i = 0; i < segs.n; i += window) {
+        size_t n = segs.n - i < window ? segs.n - i : window;
+        pool_for(0, n, 1, format_range, &segs.s[i]);
+        for (size_t j = i; j < i + n; j++) {
+            fwrite(segs.s[j].text, 1, segs.s[j].length, out);
+            free(segs.s[j].text);
+        }
+    }
+    mem_free(MEM_OUTPUT, segs.s);
+}
+
+void show_entries_raw(FILE *out, struct entry e[], int n) {
     uint32_t depth = 0;
     uint32_t offset = 0;
 
     for(uint32_t i = 0; i < n; i++)
     {
 	depth = e[i].depth;
-	indent(depth);
+	indent(out, depth);
         offset = e[i].n_components - 1;
 
-	printf("%s %"PRIu64"\n", e[i].components[offset], e[i].size);
+	fprintf(out, "%s %"PRIu64"\n", e[i].components[offset], e[i].size);
     } 
 }
 
+static int compare_names(const void *p1, const void *p2) {
+    struct entry * const *e1 = p1;
+    struct entry * const *e2 = p2;
+
+    return strcmp((*e1)->components[(*e1)->n_components - 1],
+                  (*e2)->components[(*e2)->n_components - 1]);
+}
+
+/*
+ * Emit the tree as du would in sorted postorder: each entry
+ * after its children, which are in name order. This is the
+ * input --diff wants.
+ */
+void show_du(FILE *out, struct entry *e) {
+    struct entry **children =
+        mem_malloc(MEM_OUTPUT, e->n_children * sizeof(children[0]) + 1);
+
+    if (!children) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(children, e->children, e->n_children * sizeof(children[0]));
+    qsort(children, e->n_children, sizeof(children[0]), compare_names);
+    for (uint32_t i = 0; i < e->n_children; i++)
+        show_du(out, children[i]);
+    mem_free(MEM_OUTPUT, children);
+
+    fprintf(out, "%" PRIu64 "\t%s", e->size, e->components[0]);
+    for (uint32_t i = 1; i < e->n_components; i++) {
+        putc('/', out);
+        fputs(e->components[i], out);
+    }
+    putc('\n', out);
+}
+
+static void json_string(FILE *out, const char *s) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            putc(c, out);
+    }
+}
+
+/*
+ * Emit the tree as nested JSON objects, one per line, with
+ * the same names and order as the text tree.
+ */
+void show_json(FILE *out, struct entry *e, uint32_t depth) {
+    struct entry *end = chain_end(e);
+    uint32_t first = depth > 0 ? e->n_components - 1 : 0;
+
+    fputs("{\"name\": \"", out);
+    json_string(out, end->components[first]);
+    for (uint32_t i = first + 1; i < end->n_components; i++) {
+        putc('/', out);
+        json_string(out, end->components[i]);
+    }
+    fprintf(out, "\", \"id\": \"%016" PRIx64 "\", \"size\": %" PRIu64,
+            entry_id(end), e->size);
+    if (dir_counts) {
+        uint32_t subdirs;
+        uint64_t n = dir_entries(e, &subdirs);
+        fprintf(out, ", \"entries\": %" PRIu64 ", \"subdirs\": %" PRIu32,
+                n, subdirs);
+    }
+    if (end->n_children > 0) {
+        fputs(", \"children\": [\n", out);
+        for (uint32_t i = 0; i < end->n_children; i++) {
+            if (i > 0)
+                fputs(",\n", out);
+            show_json(out, end->children[i], depth + 1);
+        }
+        putc(']', out);
+    }
+    putc('}', out);
+    if (depth == 0)
+        putc('\n', out);
+}
+
+#ifndef DUVIS_NO_MAIN
 static void status(char *msg) {
     static int pass = 1;
     fprintf(stderr, "(%d) %s\n", pass++, msg);
 } 
+#endif
 
 #ifdef DEBUG
 /*
@@ -394,26 +877,215 @@ static void dispEntries(struct entry e[], int n) {
 
 #endif
 
-int find_max_depths(struct entry *e) {
-    int max_depth = 0;
-    for (int i = 0; i < e->n_children; i++) {
-        struct entry *c = e->children[i];
-        find_max_depths(c);
+static void max_depth_subtree(struct entry *e, uint32_t depth) {
+    struct entry *end = chain_end(e);
+    uint32_t max_depth = 0;
+
+    for_children(end, depth + 1, max_depth_subtree);
+    for (uint32_t i = 0; i < end->n_children; i++) {
+        struct entry *c = end->children[i];
         if (c->max_depth > max_depth)
             max_depth = c->max_depth;
     }
-    return max_depth + 1;
+    e->max_depth = max_depth + 1;
 }
 
+/* Depths are in display levels, so folded chains count once. */
+int find_max_depths(struct entry *e) {
+    max_depth_subtree(e, 0);
+    return e->max_depth;
+}
+
+#ifndef DUVIS_NO_MAIN
+
 static char *iobuf;
 
+/*
+ * Output sinks. Each --output names a format and a file;
+ * all of them are written from the one tree, concurrently,
+ * since none of them change it.
+ */
+enum sink_format {
+    SINK_TREE, SINK_RAW, SINK_JSON, SINK_DU, SINK_PNG, SINK_SUNBURST,
+    SINK_SQLITE, SINK_ARROW
+};
+
+static char *sink_names[] = {"tree", "raw", "json", "du", "png", "sunburst",
+                             "sqlite", "arrow"};
+
+#define N_SINK_FORMATS (sizeof(sink_names) / sizeof(sink_names[0]))
+
+struct sink {
+    enum sink_format format;
+    char *file;               // "-" for standard output
+    struct task task;
+};
+
+static struct sink *sinks = 0;
+static int n_sinks = 0;
+
+/* Parse FORMAT:FILE into a new sink. */
+static void add_sink(char *arg) {
+    char *colon = strchr(arg, ':');
+    int format;
+
+    for (format = 0; format < N_SINK_FORMATS; format++)
+        if (colon && colon - arg == strlen(sink_names[format]) &&
+            !strncmp(arg, sink_names[format], colon - arg))
+            break;
+    if (format == N_SINK_FORMATS || colon[1] == '\0') {
+        fprintf(stderr, "--output: want FORMAT:FILE, with FORMAT "
+                "tree, raw, json, du, png, sunburst, sqlite or arrow\n");
+        exit(1);
+    }
+
+    sinks = realloc(sinks, (n_sinks + 1) * sizeof(sinks[0]));
+    if (!sinks) {
+        perror("realloc");
+        exit(1);
+    }
+    sinks[n_sinks].format = format;
+    sinks[n_sinks].file = colon + 1;
+    n_sinks++;
+}
+
+static void run_sink(void *arg) {
+    struct sink *k = arg;
+
+    if (k->format == SINK_PNG || k->format == SINK_SUNBURST) {
+        render_png(k->file, k->format == SINK_SUNBURST);
+        return;
+    }
+    if (k->format == SINK_SQLITE) {
+        write_sqlite(k->file, root_entry);
+        return;
+    }
+
+    FILE *out = stdout;
+    if (strcmp(k->file, "-")) {
+        out = fopen(k->file, "w");
+        if (!out) {
+            perror(k->file);
+            exit(1);
+        }
+    }
+
+    switch (k->format) {
+    case SINK_TREE:
+        show_tree(out, root_entry);
+        break;
+    case SINK_RAW:
+        show_entries_raw(out, entries, n_entries);
+        break;
+    case SINK_JSON:
+        show_json(out, root_entry, 0);
+        break;
+    case SINK_DU:
+        show_du(out, root_entry);
+        break;
+    case SINK_ARROW:
+        show_arrow(out, root_entry);
+        break;
+    default:
+        abort();
+    }
+
+    if (out == stdout ? fflush(out) == EOF : fclose(out) == EOF) {
+        perror(k->file);
+        exit(1);
+    }
+}
+
+static void run_sinks(void) {
+    for (int i = 0; i < n_sinks; i++)
+        pool_fork(&sinks[i].task, run_sink, &sinks[i]);
+    for (int i = n_sinks - 1; i >= 0; i--)
+        pool_join(&sinks[i].task);
+}
+
+static void show_mem_report(void) {
+    mem_report(stderr);
+}
+
+/* Values for options that only have a long form. */
+enum {
+    OPT_CACHE = 256,
+    OPT_CACHE_KEY,
+    OPT_THREADS,
+    OPT_DU,
+    OPT_FANOUT,
+    OPT_OUTPUT,
+    OPT_MEM_REPORT,
+    OPT_DIFF,
+    OPT_THRESHOLD,
+    OPT_DUPES,
+    OPT_COMPRESS,
+    OPT_WHAT_IF,
+    OPT_SQLITE,
+    OPT_ARROW,
+    OPT_FLEET,
+    OPT_QUERY,
+    OPT_TOP,
+    OPT_SCAN,
+    OPT_JOURNAL,
+    OPT_RESUME,
+    OPT_RECHECK,
+    OPT_HOT,
+    OPT_LOOKUP,
+    OPT_COUNT_INODES,
+    OPT_PATCH,
+};
+
+static struct option long_options[] = {
+    {"collapse", no_argument, 0, 'c'},
+    {"cache", required_argument, 0, OPT_CACHE},
+    {"cache-key", required_argument, 0, OPT_CACHE_KEY},
+    {"threads", required_argument, 0, OPT_THREADS},
+    {"du", no_argument, 0, OPT_DU},
+    {"fanout", required_argument, 0, OPT_FANOUT},
+    {"output", required_argument, 0, OPT_OUTPUT},
+    {"mem-report", no_argument, 0, OPT_MEM_REPORT},
+    {"diff", no_argument, 0, OPT_DIFF},
+    {"threshold", required_argument, 0, OPT_THRESHOLD},
+    {"dupes", no_argument, 0, OPT_DUPES},
+    {"compress", required_argument, 0, OPT_COMPRESS},
+    {"what-if", required_argument, 0, OPT_WHAT_IF},
+    {"sqlite", required_argument, 0, OPT_SQLITE},
+    {"arrow", required_argument, 0, OPT_ARROW},
+    {"fleet", required_argument, 0, OPT_FLEET},
+    {"query", required_argument, 0, OPT_QUERY},
+    {"top", required_argument, 0, OPT_TOP},
+    {"scan", no_argument, 0, OPT_SCAN},
+    {"journal", required_argument, 0, OPT_JOURNAL},
+    {"resume", no_argument, 0, OPT_RESUME},
+    {"recheck", no_argument, 0, OPT_RECHECK},
+    {"hot", required_argument, 0, OPT_HOT},
+    {"lookup", required_argument, 0, OPT_LOOKUP},
+    {"count-inodes", no_argument, 0, OPT_COUNT_INODES},
+    {"patch", no_argument, 0, OPT_PATCH},
+    {0, 0, 0, 0}
+};
+
 int main(int argc, char **argv) {
 
     int c;
-    int pflag = 0, gflag = 0, rflag = 0, zeroflag = 0;
+    int pflag = 0, gflag = 0, rflag = 0, zeroflag = 0, cflag = 0;
+    char *cache_dir = 0, *cache_key = 0;
+    int n_threads = 0;
+    int duflag = 0, du_fd = -1, streamed = 0;
+    int n_fanout = 0;
+    int diffflag = 0, dupesflag = 0, patchflag = 0;
+    uint64_t threshold = 0, compress_budget = 0;
+    char *fanout_dir = ".";
+    char *what_if = 0, *sink_arg;
+    char *fleet_list = 0, **queries = 0;
+    int n_queries = 0, top = 10;
+    int scanflag = 0, resumeflag = 0, recheckflag = 0, hot = 0;
+    int inodesflag = 0;
+    char *journal_file = 0, *lookup_file = 0;
     FILE *inf = stdin;
 
-    while((c = getopt(argc, argv, "pgr0")) != -1)
+    while((c = getopt_long(argc, argv, "pgr0cs", long_options, 0)) != -1)
     {
         switch(c) {
             case 'p':// Enable pre-order sorting
@@ -428,6 +1100,120 @@ int main(int argc, char **argv) {
             case '0':// Enable GUI
                 zeroflag = 1;
                 break;
+            case 's':// Start the GUI in the sunburst view
+                gflag = 1;
+                sunburst_view = 1;
+                break;
+            case 'c':// Fold single-child chains into one node
+                cflag = 1;
+                break;
+            case OPT_CACHE:// Reuse parsed chunks of earlier runs
+                cache_dir = optarg;
+                break;
+            case OPT_CACHE_KEY:// Identity of the input in the cache
+                cache_key = optarg;
+                break;
+            case OPT_DU:// Run du on the remaining arguments
+                duflag = 1;
+                break;
+            case OPT_FANOUT:// Run this many du's over the top level
+                n_fanout = atoi(optarg);
+                if (n_fanout <= 0) {
+                    fprintf(stderr, "--fanout: need a positive count\n");
+                    exit(1);
+                }
+                break;
+            case OPT_OUTPUT:// Write one more format from the same tree
+                add_sink(optarg);
+                break;
+            case OPT_MEM_REPORT:// Account for memory by subsystem
+                mem_accounting = 1;
+                atexit(show_mem_report);
+                break;
+            case OPT_DIFF:// Compare two sorted postorder captures
+                diffflag = 1;
+                break;
+            case OPT_PATCH:// Write --diff as a binary patch by node ID
+                patchflag = 1;
+                break;
+            case OPT_THRESHOLD:// Smallest change --diff reports
+                threshold = strtoull(optarg, 0, 10);
+                break;
+            case OPT_DUPES:// Look for duplicate files among the leaves
+                dupesflag = 1;
+                break;
+            case OPT_COMPRESS:// Megabytes to sample for compressibility
+                compress_budget = strtoull(optarg, 0, 10) * 1024 * 1024;
+                if (compress_budget == 0) {
+                    fprintf(stderr, "--compress: need a positive budget\n");
+                    exit(1);
+                }
+                break;
+            case OPT_WHAT_IF:// Paths to plan deleting, and where to save
+                what_if = optarg;
+                break;
+            case OPT_SQLITE:// Same as --output sqlite:FILE
+            case OPT_ARROW:// Same as --output arrow:FILE
+                sink_arg = malloc(strlen(optarg) + 8);
+                if (!sink_arg) {
+                    perror("malloc");
+                    exit(1);
+                }
+                sprintf(sink_arg, "%s:%s",
+                        c == OPT_SQLITE ? "sqlite" : "arrow", optarg);
+                add_sink(sink_arg);
+                break;
+            case OPT_FLEET:// Load many hosts' captures together
+                fleet_list = optarg;
+                break;
+            case OPT_QUERY:// A path to total over the fleet
+                queries = realloc(queries,
+                                  (n_queries + 1) * sizeof(queries[0]));
+                if (!queries) {
+                    perror("realloc");
+                    exit(1);
+                }
+                queries[n_queries++] = optarg;
+                break;
+            case OPT_TOP:// Hosts listed per --query
+                top = atoi(optarg);
+                break;
+            case OPT_SCAN:// Walk the directory ourselves instead of du
+                scanflag = 1;
+                break;
+            case OPT_JOURNAL:// Checkpoint the scan into this file
+                journal_file = optarg;
+                break;
+            case OPT_RESUME:// Continue the scan in the journal
+                resumeflag = 1;
+                break;
+            case OPT_RECHECK:// Rescan journaled directories that changed
+                recheckflag = 1;
+                break;
+            case OPT_HOT:// Scan biggest first, showing this many largest
+                hot = atoi(optarg);
+                if (hot <= 0) {
+                    fprintf(stderr, "--hot: need a positive count\n");
+                    exit(1);
+                }
+                scanflag = 1;
+                break;
+            case OPT_LOOKUP:// Paths to print the sizes of, not the tree
+                lookup_file = optarg;
+                break;
+            case OPT_COUNT_INODES:// Scan counting names, not blocks
+                inodesflag = 1;
+                scanflag = 1;
+                dir_counts = 1;
+                show_extra = show_counts;
+                break;
+            case OPT_THREADS:// Size of the shared thread pool
+                n_threads = atoi(optarg);
+                if (n_threads <= 0) {
+                    fprintf(stderr, "--threads: need a positive count\n");
+                    exit(1);
+                }
+                break;
             case '?':// Error handling
                 fprintf(stderr, "Unknown option -%c\n", optopt);
                 exit(1);
@@ -436,7 +1222,67 @@ int main(int argc, char **argv) {
         }
     }
     
-    if (optind < argc) {
+    /* A diff streams both files and builds no tree. */
+    if (diffflag) {
+        if (optind != argc - 2) {
+            fprintf(stderr, "--diff: want OLD and NEW captures\n");
+            exit(1);
+        }
+        diff_captures(stdout, argv[optind], argv[optind + 1], zeroflag,
+                      threshold, patchflag);
+        return 0;
+    }
+
+    /* The fleet has no single tree either. */
+    if (fleet_list) {
+        pool_init(n_threads);
+        fleet_load(fleet_list, zeroflag);
+        for (int i = 0; i < n_queries; i++)
+            fleet_query(stdout, queries[i], top);
+        return 0;
+    }
+
+    /* With --output, -r is one more sink. */
+    if (n_sinks > 0 && rflag)
+        add_sink("raw:-");
+    int n_stdout = 0;
+    for (int i = 0; i < n_sinks; i++)
+        if (!strcmp(sinks[i].file, "-"))
+            n_stdout++;
+    if (n_stdout > 1) {
+        fprintf(stderr, "--output: only one output can go to -\n");
+        exit(1);
+    }
+
+    if ((journal_file && !scanflag) || (resumeflag && !journal_file) ||
+        (recheckflag && !resumeflag)) {
+        fprintf(stderr, "--recheck needs --resume, which needs --journal, "
+                "which needs --scan\n");
+        exit(1);
+    }
+    if (n_fanout > 0 || scanflag) {
+        if (duflag || cache_dir || (n_fanout > 0 && scanflag)) {
+            fprintf(stderr, "--fanout and --scan: cannot be used with each "
+                    "other, --du or --cache\n");
+            exit(1);
+        }
+        if (optind < argc - 1) {
+            fprintf(stderr, "extra argument(s)\n");
+            exit(1);
+        }
+        if (optind < argc)
+            fanout_dir = argv[optind];
+    } else if (duflag) {
+        /* Everything left over is for du. */
+        du_fd = du_spawn(&argv[optind], argc - optind);
+        if (cache_dir) {
+            inf = fdopen(du_fd, "r");
+            if (!inf) {
+                perror("fdopen");
+                exit(1);
+            }
+        }
+    } else if (optind < argc) {
         if (optind < argc - 1) {
             fprintf(stderr, "extra argument(s)\n");
             exit(1);
@@ -449,24 +1295,44 @@ int main(int argc, char **argv) {
         }
     }
 
-    // Set up for large IOs
-    iobuf = malloc(IO_BUFFER_LENGTH);
-    
-    if (!iobuf) {
-        perror("malloc(iobuf)");
-        exit(1);
-    }
-    
-    int result = setvbuf(inf, iobuf, _IOFBF, IO_BUFFER_LENGTH);
-    
-    if (result) {
-        perror("setvbuf");
-        exit(1);
+    pool_init(n_threads);
+
+    // Set up for large IOs; only the cache reads through stdio
+    if (cache_dir) {
+        iobuf = mem_malloc(MEM_INPUT, IO_BUFFER_LENGTH);
+
+        if (!iobuf) {
+            perror("malloc(iobuf)");
+            exit(1);
+        }
+
+        int result = setvbuf(inf, iobuf, _IOFBF, IO_BUFFER_LENGTH);
+
+        if (result) {
+            perror("setvbuf");
+            exit(1);
+        }
     }
 
     // Read in data from du
     status("Parsing du file.");
-    read_entries(inf, zeroflag);
+    if (n_fanout > 0) {
+        fanout_entries(fanout_dir, n_fanout, zeroflag);
+    } else if (scanflag) {
+        scan_entries(fanout_dir, journal_file, resumeflag, recheckflag, hot,
+                     inodesflag);
+    } else if (cache_dir) {
+        if (!cache_key)
+            cache_key = optind < argc ? argv[optind] : "-";
+        cache_read_entries(inf, zeroflag, cache_dir, cache_key);
+        du_wait();
+    } else {
+        /* Without -p, the tree is built as the entries arrive. */
+        stream_entries(duflag ? du_fd : fileno(inf), zeroflag,
+                       pflag ? 0 : postorder_add);
+        du_wait();
+        streamed = !pflag;
+    }
 
     if (n_entries == 0)
         return 0;
@@ -479,7 +1345,7 @@ int main(int argc, char **argv) {
     // pre order
     if(pflag) {
         status("Sorting entries.");
-        qsort(entries, n_entries, sizeof(entries[0]), compare_entries);
+        pool_sort(entries, n_entries, sizeof(entries[0]), compare_entries);
 
         if(entries[0].n_components == 0) {
             fprintf(stderr, "Mysterious zero-length entry in table.\n");
@@ -489,26 +1355,88 @@ int main(int argc, char **argv) {
         status("Building tree (preorder).");
         root_entry = &entries[0];
         base_depth = root_entry->n_components;
-        build_tree_preorder(0, n_entries, 0);
+        build_tree_preorder();
+        status("Sorting children.");
+        sort_children();
     } else {
         status("Building tree (postorder).");
-        root_entry = &entries[n_entries - 1];
-        base_depth = root_entry->n_components;
-        build_tree_postorder(0, n_entries, 0);
+        if (streamed)
+            postorder_finish();
+        else
+            build_tree_postorder();
+        status("Sorting children.");
+        sort_children();
+    }
+
+    if (lookup_file) {
+        status("Looking up paths.");
+        lookup_paths(stdout, lookup_file, zeroflag);
+        return 0;
+    }
+
+    if (cflag) {
+        status("Collapsing chains.");
+        collapse_chains(root_entry);
+    }
+
+    if (what_if || gflag) {
+        status("Planning deletions.");
+        plan_init(cflag);
+        if (what_if)
+            plan_read(what_if);
     }
 
-    if (gflag) {
+    if (dupesflag) {
+        status("Finding duplicates.");
+        find_dupes();
+        if (gflag)
+            show_dupes(stdout);
+    }
+
+    if (compress_budget > 0) {
+        status("Sampling compressibility.");
+        estimate_compression(compress_budget);
+    }
+
+    if (n_sinks > 0) {
+        int drawn = gflag;
+        for (int i = 0; i < n_sinks; i++)
+            if (sinks[i].format == SINK_PNG ||
+                sinks[i].format == SINK_SUNBURST)
+                drawn = 1;
+        if (drawn) {
+            status("Recording depths.");
+            find_max_depths(root_entry);
+        }
+        status("Writing outputs.");
+        run_sinks();
+        if (gflag) {
+            status("Rendering tree.");
+            gui(argc, argv);
+        }
+    } else if (gflag) {
         status("Recording depths.");
         find_max_depths(root_entry);
         status("Rendering tree.");
         gui(argc, argv);
     } else if (rflag) {
         status("Emitting entries.");
-        show_entries_raw(entries, n_entries);
+        show_entries_raw(stdout, entries, n_entries);
     } else {
         status("Emitting tree.");
-        show_entries(root_entry);
+        show_tree(stdout, root_entry);
     }
+
+    if (dupesflag && !gflag)
+        show_dupes(stdout);
+
+    if (n_marks > 0)
+        fprintf(stderr, "what-if: %d marked, %" PRIu64 " freed\n",
+                n_marks, plan_freed);
+    if (what_if && gflag)
+        plan_write(what_if);
     
     return(0); 
 }
+
+#endif
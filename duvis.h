@@ -23,6 +23,7 @@ struct entry {
     uint32_t depth;           // The depth of this entry in the directory tree
     uint32_t max_depth;       // The depth of the tree at this entry
     uint32_t n_children;      // # of children directories at this entry level
+    uint32_t n_chain;         // # of single-child levels folded into this one
     struct entry **children;  // Children entries of this entry
 };
 
@@ -31,4 +32,66 @@ extern struct entry *entries;
 extern struct entry *root_entry;
 extern int base_depth;
 
+extern struct entry *new_entry(void);
+extern void trim_entries(void);
+extern void parse_entry(struct entry *entry, int line_number);
+extern struct entry *add_line(const char *line, int nchars, int line_number);
+extern struct entry *add_parsed(uint64_t size, uint32_t n_components,
+                                const char *components, int len);
+
+extern void postorder_add(int i);
+extern void postorder_finish(void);
+
+extern int du_spawn(char **args, int n_args);
+extern void du_wait(void);
+extern void stream_entries(int fd, int zeroflag, void (*added)(int i));
+extern void fanout_entries(const char *dir, int n_procs, int zeroflag);
+extern void scan_entries(const char *dir, const char *journal_file,
+                         int resume, int recheck, int top, int inodes);
+
+extern int compare_subtrees(const void *p1, const void *p2);
+extern struct entry *chain_end(struct entry *e);
+extern char *entry_path(struct entry *e, char *buf, size_t n);
+extern char *chain_name(struct entry *e, uint32_t depth, char *buf, size_t n);
+extern uint64_t path_id(const char *path);
+extern uint64_t entry_id(struct entry *e);
+extern void (*show_extra)(FILE *out, struct entry *e);
+extern int dir_counts;
+extern uint64_t dir_entries(struct entry *e, uint32_t *subdirs);
+
+extern void indent(FILE *out, uint32_t depth);
+extern void show_tree(FILE *out, struct entry *root);
+extern void show_entries_raw(FILE *out, struct entry e[], int n);
+extern void show_json(FILE *out, struct entry *e, uint32_t depth);
+extern void show_du(FILE *out, struct entry *e);
+extern void show_arrow(FILE *out, struct entry *root);
+extern void write_sqlite(const char *file, struct entry *root);
+
+extern void find_dupes(void);
+extern void show_dupes(FILE *out);
+
+extern int n_marks;
+extern uint64_t plan_freed;
+extern void plan_init(int collapsed);
+extern int plan_toggle(struct entry *e);
+extern void plan_undo(void);
+extern void plan_read(const char *file);
+extern void plan_write(const char *file);
+
+extern void estimate_compression(uint64_t budget);
+
+extern void lookup_paths(FILE *out, const char *file, int zeroflag);
+
+extern void fleet_load(const char *list, int zeroflag);
+extern void fleet_query(FILE *out, const char *path, int top);
+
+extern void diff_captures(FILE *out, const char *old_name,
+                          const char *new_name, int zeroflag,
+                          uint64_t threshold, int patch);
+
 extern int gui(int argv, char **argc);
+extern void render_png(const char *file, int sunburst);
+extern int sunburst_view;
+
+extern void cache_read_entries(FILE *f, int zeroflag,
+                               const char *cache_dir, const char *key);
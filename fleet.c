@@ -0,0 +1,374 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Fleet mode: du captures of many hosts held at once. Every
+ * path component of every host is interned into one shared
+ * dictionary, and each host keeps only a compact tree of
+ * (parent, name, size) nodes with a hash index on (parent,
+ * name), so similar hosts cost about 16 bytes of nodes and
+ * 8 to 16 of index per entry, and no text. Captures are
+ * loaded one at a time; a query looks the path up in every
+ * host in parallel and reduces the sizes into a fleet total
+ * and the top hosts.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+#include "pool.h"
+
+#define FLEET_SEED 0x666c656574000001ULL
+#define FLEET_ARENA_LENGTH (1024 * 1024)
+#define FLEET_IO_LENGTH (1024 * 1024)
+
+/* The parent of the root, and the name of a missing component. */
+#define NO_NODE UINT32_MAX
+
+/* Shared name dictionary. */
+static char **names = 0;
+static uint32_t n_names = 0, max_names = 0;
+static uint32_t *name_slots = 0;      // Name id + 1, or 0 if empty
+static uint32_t name_mask = 0;
+static char *arena = 0;
+static size_t n_arena = FLEET_ARENA_LENGTH;
+static size_t name_bytes = 0;
+
+struct node {
+    uint32_t parent;
+    uint32_t name;
+    uint64_t size;
+};
+
+struct host {
+    char *name;
+    struct node *nodes;       // Node 0 is above the first component
+    uint32_t n_nodes, max_nodes;
+    uint32_t *slots;          // Node index + 1, or 0 if empty
+    uint32_t mask;
+};
+
+static struct host *hosts = 0;
+static uint32_t n_hosts = 0;
+
+static void *fleet_alloc(void *p, size_t size) {
+    p = mem_realloc(MEM_FLEET, p, size);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static uint64_t name_hash(const char *s, size_t len) {
+    return hash64(s, len, FLEET_SEED);
+}
+
+/* The slot for s, which holds its id + 1 if it is interned. */
+static uint32_t *name_slot(const char *s, size_t len) {
+    uint32_t i = name_hash(s, len) & name_mask;
+
+    while (name_slots[i]) {
+        const char *t = names[name_slots[i] - 1];
+        if (!strncmp(t, s, len) && t[len] == '\0')
+            break;
+        i = (i + 1) & name_mask;
+    }
+    return &name_slots[i];
+}
+
+static void grow_names(void) {
+    uint32_t n_slots = name_slots ? 2 * (name_mask + 1) : 1024;
+
+    mem_free(MEM_FLEET, name_slots);
+    name_slots = mem_calloc(MEM_FLEET, n_slots, sizeof(name_slots[0]));
+    if (!name_slots) {
+        perror("calloc");
+        exit(1);
+    }
+    name_mask = n_slots - 1;
+    for (uint32_t id = 0; id < n_names; id++)
+        *name_slot(names[id], strlen(names[id])) = id + 1;
+}
+
+static uint32_t intern(const char *s, size_t len) {
+    if (2 * (n_names + 1) > name_mask + 1 || !name_slots)
+        grow_names();
+
+    uint32_t *slot = name_slot(s, len);
+    if (*slot)
+        return *slot - 1;
+
+    if (n_arena + len + 1 > FLEET_ARENA_LENGTH) {
+        if (arena)
+            mem_slack(MEM_FLEET, FLEET_ARENA_LENGTH - n_arena);
+        arena = fleet_alloc(0, len + 1 > FLEET_ARENA_LENGTH ?
+                            len + 1 : FLEET_ARENA_LENGTH);
+        n_arena = 0;
+    }
+    char *copy = arena + n_arena;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    n_arena += len + 1;
+    name_bytes += len + 1;
+
+    if (n_names >= max_names) {
+        max_names = max_names ? 2 * max_names : 1024;
+        names = fleet_alloc(names, max_names * sizeof(names[0]));
+    }
+    names[n_names] = copy;
+    *slot = ++n_names;
+    return n_names - 1;
+}
+
+static uint32_t *node_slot(struct host *h, uint32_t parent, uint32_t name) {
+    uint32_t i = hash_mix((uint64_t) parent << 32 | name) & h->mask;
+
+    while (h->slots[i]) {
+        struct node *n = &h->nodes[h->slots[i] - 1];
+        if (n->parent == parent && n->name == name)
+            break;
+        i = (i + 1) & h->mask;
+    }
+    return &h->slots[i];
+}
+
+static void grow_nodes(struct host *h) {
+    uint32_t n_slots = h->slots ? 2 * (h->mask + 1) : 1024;
+
+    mem_free(MEM_FLEET, h->slots);
+    h->slots = mem_calloc(MEM_FLEET, n_slots, sizeof(h->slots[0]));
+    if (!h->slots) {
+        perror("calloc");
+        exit(1);
+    }
+    h->mask = n_slots - 1;
+    for (uint32_t i = 1; i < h->n_nodes; i++)
+        *node_slot(h, h->nodes[i].parent, h->nodes[i].name) = i + 1;
+}
+
+/* The child of parent with the given name, made if missing. */
+static uint32_t child(struct host *h, uint32_t parent, uint32_t name) {
+    if (2 * (h->n_nodes + 1) > h->mask + 1)
+        grow_nodes(h);
+
+    uint32_t *slot = node_slot(h, parent, name);
+    if (*slot)
+        return *slot - 1;
+
+    if (h->n_nodes >= h->max_nodes) {
+        h->max_nodes *= 2;
+        h->nodes = fleet_alloc(h->nodes, h->max_nodes * sizeof(h->nodes[0]));
+    }
+    struct node *n = &h->nodes[h->n_nodes];
+    n->parent = parent;
+    n->name = name;
+    n->size = 0;
+    *slot = ++h->n_nodes;
+    return h->n_nodes - 1;
+}
+
+static void load_host(struct host *h, const char *file, int zeroflag) {
+    FILE *f = fopen(file, "r");
+    char term = zeroflag ? '\0' : '\n';
+    char *line = 0;
+    size_t max_line = 0;
+    ssize_t n;
+    int line_number = 0;
+
+    if (!f || setvbuf(f, 0, _IOFBF, FLEET_IO_LENGTH)) {
+        perror(file);
+        exit(1);
+    }
+    h->max_nodes = 1024;
+    h->nodes = fleet_alloc(0, h->max_nodes * sizeof(h->nodes[0]));
+    h->nodes[0].parent = NO_NODE;
+    h->nodes[0].name = NO_NODE;
+    h->nodes[0].size = 0;
+    h->n_nodes = 1;
+    /* Even an empty capture can be queried. */
+    grow_nodes(h);
+
+    errno = 0;
+    while ((n = getdelim(&line, &max_line, term, f)) != -1) {
+        line_number++;
+        if (line[n - 1] == term)
+            line[--n] = '\0';
+
+        char *path;
+        uint64_t size = strtoull(line, &path, 10);
+        if (path == line || (*path != ' ' && *path != '\t')) {
+            fprintf(stderr, "%s line %d: buffer format error\n",
+                    file, line_number);
+            exit(1);
+        }
+        path++;
+
+        uint32_t node = 0;
+        while (*path) {
+            size_t len = strcspn(path, "/");
+            if (len > 0)
+                node = child(h, node, intern(path, len));
+            path += len + (path[len] == '/');
+        }
+        h->nodes[node].size = size;
+    }
+    if (errno) {
+        perror(file);
+        exit(1);
+    }
+    free(line);
+    fclose(f);
+
+    /* The last doubling is mostly unused. */
+    mem_slack(MEM_FLEET, (int64_t) (h->max_nodes - h->n_nodes) *
+              (int64_t) sizeof(h->nodes[0]));
+}
+
+/*
+ * Load every capture listed in list, one per line. A line
+ * is HOST, a tab and FILE, or just FILE, when the host is
+ * named by the file's last component.
+ */
+void fleet_load(const char *list, int zeroflag) {
+    FILE *f = fopen(list, "r");
+    char *line = 0;
+    size_t max_line = 0;
+    ssize_t n;
+    uint32_t max_hosts = 0;
+    uint64_t n_nodes = 0;
+
+    if (!f) {
+        perror(list);
+        exit(1);
+    }
+    while ((n = getline(&line, &max_line, f)) != -1) {
+        if (n > 0 && line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+
+        char *file = strchr(line, '\t');
+        char *name = line;
+        if (file) {
+            *file++ = '\0';
+        } else {
+            file = line;
+            name = strrchr(line, '/');
+            name = name ? name + 1 : line;
+        }
+
+        if (n_hosts >= max_hosts) {
+            max_hosts = max_hosts ? 2 * max_hosts : 64;
+            hosts = fleet_alloc(hosts, max_hosts * sizeof(hosts[0]));
+        }
+        struct host *h = &hosts[n_hosts++];
+        memset(h, 0, sizeof(*h));
+        h->name = fleet_alloc(0, strlen(name) + 1);
+        strcpy(h->name, name);
+        load_host(h, file, zeroflag);
+        n_nodes += h->n_nodes - 1;
+    }
+    free(line);
+    fclose(f);
+
+    fprintf(stderr, "fleet: %" PRIu32 " hosts, %" PRIu64 " nodes, %" PRIu32
+            " names in %zu bytes\n", n_hosts, n_nodes, n_names, name_bytes);
+}
+
+struct query {
+    uint32_t *path;           // Name ids
+    int n_path;
+    uint64_t *sizes;          // By host
+    unsigned char *found;
+};
+
+static void query_range(size_t start, size_t end, void *arg) {
+    struct query *q = arg;
+
+    for (size_t i = start; i < end; i++) {
+        struct host *h = &hosts[i];
+        uint32_t node = 0;
+        for (int k = 0; k < q->n_path && node != NO_NODE; k++) {
+            uint32_t slot = *node_slot(h, node, q->path[k]);
+            node = slot ? slot - 1 : NO_NODE;
+        }
+        q->found[i] = node != NO_NODE;
+        q->sizes[i] = node != NO_NODE ? h->nodes[node].size : 0;
+    }
+}
+
+static uint64_t *sort_sizes;
+
+static int compare_hosts(const void *p1, const void *p2) {
+    uint32_t h1 = *(const uint32_t *) p1;
+    uint32_t h2 = *(const uint32_t *) p2;
+
+    if (sort_sizes[h1] != sort_sizes[h2])
+        return sort_sizes[h1] > sort_sizes[h2] ? -1 : 1;
+    return h1 < h2 ? -1 : 1;
+}
+
+/*
+ * Print the total size of path over all the hosts that
+ * have it, then the top hosts by its size, largest first.
+ */
+void fleet_query(FILE *out, const char *path, int top) {
+    struct query q;
+    int max_path = strlen(path) / 2 + 1;
+    int missing = 0;
+
+    q.path = fleet_alloc(0, max_path * sizeof(q.path[0]));
+    q.n_path = 0;
+    for (const char *s = path; *s; ) {
+        size_t len = strcspn(s, "/");
+        if (len > 0) {
+            uint32_t slot = name_slots ? *name_slot(s, len) : 0;
+            if (!slot)
+                missing = 1;
+            q.path[q.n_path++] = slot - 1;
+        }
+        s += len + (s[len] == '/');
+    }
+
+    q.sizes = fleet_alloc(0, (n_hosts + 1) * sizeof(q.sizes[0]));
+    q.found = fleet_alloc(0, n_hosts + 1);
+    if (missing || q.n_path == 0)
+        memset(q.found, 0, n_hosts);
+    else
+        pool_for(0, n_hosts, 0, query_range, &q);
+
+    uint32_t *order = fleet_alloc(0, (n_hosts + 1) * sizeof(order[0]));
+    uint32_t n_found = 0;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < n_hosts; i++)
+        if (q.found[i]) {
+            order[n_found++] = i;
+            total += q.sizes[i];
+        }
+    sort_sizes = q.sizes;
+    qsort(order, n_found, sizeof(order[0]), compare_hosts);
+
+    fprintf(out, "%s\t%" PRIu64 "\t%" PRIu32 "/%" PRIu32 " hosts\n",
+            path, total, n_found, n_hosts);
+    for (uint32_t k = 0; k < n_found && k < (uint32_t) top; k++)
+        fprintf(out, "  %" PRIu64 "\t%s\n",
+                q.sizes[order[k]], hosts[order[k]].name);
+
+    mem_free(MEM_FLEET, order);
+    mem_free(MEM_FLEET, q.found);
+    mem_free(MEM_FLEET, q.sizes);
+    mem_free(MEM_FLEET, q.path);
+}
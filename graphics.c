@@ -6,48 +6,580 @@
  */ 
 
 #include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
 
 #include <cairo.h>
 #include <gtk/gtk.h>
 
 #include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 static int display_width, display_height;
 
-static void draw_node(cairo_t *cr, struct entry *e,
-                      int x, int y, int width, int height) {
+/* Size of images written with --output. */
+#define PNG_WIDTH 1600
+#define PNG_HEIGHT 1200
+
+/* Start in the sunburst view rather than the xdu columns. */
+int sunburst_view = 0;
+
+/*
+ * Labels. Text widths are measured once per distinct name
+ * and kept in a cache keyed by a hash of the text, so the
+ * many copies of a common name share one measurement; each
+ * node's whole label, name and size, is formatted and
+ * measured once per node and size, and drawn from the cache
+ * after that. Both caches are set-associative, with the
+ * oldest way of a set replaced on a miss. A label that does
+ * not fit drops its size, then is cut short; a box too short
+ * for a line of text gets none.
+ */
+
+#define FONT_SIZE 20
+#define LABEL_MARGIN 4
+#define CACHE_WAYS 4
+#define N_EXTENTS (16 * 1024)
+#define N_LABELS (64 * 1024)
+
+#define EXTENT_SEED 0x657874656e740001ULL
+
+static const char slash[] = "/";
+static const char ellipsis[] = "...";
+
+struct extent {
+    const char *s;
+    uint64_t hash;
+    double width;
+};
 
-    /* Length of 2**64 - 1, +1 for null */
-    char sizeStr[21];
+struct label {
+    struct entry *e;
+    uint64_t size;
+    double name_width, size_width;
+    size_t name_length;       // The size follows the name in text
+    char *text;
+    size_t max_text;
+};
 
-    int txtX = width / 4; 
-    int txtY = height / 2;
+static struct extent *extents = 0;
+static struct label *labels = 0;
+static cairo_font_face_t *font = 0;
 
-    /* Copy uint64_t into char buffer */
-    sprintf(sizeStr, "%" PRIu64, e->size);
+/* Width of s, which must not move or change while drawn. */
+static double text_width(cairo_t *cr, const char *s) {
+    uint64_t h = hash64(s, strlen(s), EXTENT_SEED);
+    struct extent *set =
+        &extents[(h & (N_EXTENTS / CACHE_WAYS - 1)) * CACHE_WAYS];
 
+    for (int i = 0; i < CACHE_WAYS; i++)
+        if (set[i].s && set[i].hash == h && !strcmp(set[i].s, s))
+            return set[i].width;
+
+    cairo_text_extents_t te;
+    cairo_text_extents(cr, s, &te);
+    memmove(&set[1], &set[0], (CACHE_WAYS - 1) * sizeof(set[0]));
+    set[0].s = s;
+    set[0].hash = h;
+    set[0].width = te.x_advance;
+    return set[0].width;
+}
+
+/* The label of e, with any chain folded into it, and its widths. */
+static struct label *label(cairo_t *cr, struct entry *e) {
+    uint64_t h = hash_mix((uintptr_t) e);
+    struct label *set =
+        &labels[(h & (N_LABELS / CACHE_WAYS - 1)) * CACHE_WAYS];
+
+    for (int i = 0; i < CACHE_WAYS; i++)
+        if (set[i].e == e && set[i].size == e->size)
+            return &set[i];
+
+    /* The oldest way's buffer is reused for the new label. */
+    struct label old = set[CACHE_WAYS - 1];
+    memmove(&set[1], &set[0], (CACHE_WAYS - 1) * sizeof(set[0]));
+    struct label *l = &set[0];
+    l->text = old.text;
+    l->max_text = old.max_text;
+
+    struct entry *end = chain_end(e);
+    uint32_t first = e->depth == 0 ? 0 : e->n_components - 1;
+    size_t need = 24;             // " (" + 2**64 - 1 + ")"
+    for (uint32_t i = first; i < end->n_components; i++)
+        need += strlen(end->components[i]) + 1;
+    if (need > l->max_text) {
+        l->max_text = need;
+        l->text = mem_realloc(MEM_GUI, l->text, need);
+        if (!l->text) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    size_t len = 0;
+    l->name_width = 0;
+    for (uint32_t i = first; i < end->n_components; i++) {
+        const char *c = end->components[i];
+        if (i > first) {
+            l->text[len++] = '/';
+            l->name_width += text_width(cr, slash);
+        }
+        strcpy(l->text + len, c);
+        len += strlen(c);
+        l->name_width += text_width(cr, c);
+    }
+    l->name_length = len;
+    snprintf(l->text + len, l->max_text - len, " (%" PRIu64 ")", e->size);
+
+    cairo_text_extents_t te;
+    cairo_text_extents(cr, l->text + len, &te);
+    l->e = e;
+    l->size = e->size;
+    l->size_width = te.x_advance;
+    return l;
+}
+
+/* Cut label, width wide, to fit in room with an ellipsis. */
+static void truncate_label(cairo_t *cr, char *label, double width,
+                           double room) {
+    size_t keep = strlen(label);
+
+    room -= text_width(cr, ellipsis);
+    if (room <= 0)
+        keep = 0;
+    while (keep > 0 && width > room) {
+        /* Guess from the average glyph width, always shrinking. */
+        size_t guess = keep * room / width;
+        keep = guess < keep ? guess : keep - 1;
+        while (keep > 0 && (label[keep] & 0xc0) == 0x80)
+            keep--;
+        char c = label[keep];
+        cairo_text_extents_t te;
+        label[keep] = '\0';
+        cairo_text_extents(cr, label, &te);
+        label[keep] = c;
+        width = te.x_advance;
+    }
+    strcpy(label + keep, keep > 0 ? ellipsis : "");
+}
+
+static void draw_node(cairo_t *cr, struct entry *e,
+                      double x, double y, double width, double height) {
     /* Draw the rectangle container */
     cairo_rectangle(cr, x, y, width, height);
     cairo_stroke(cr);
 
-    /* Draw the label */
-    cairo_move_to(cr, txtX, txtY);
-    if (e->depth == 0) {
-        cairo_show_text(cr, e->components[0]);
-        for (int i = 1; i < base_depth; i++) {
-            cairo_show_text(cr, "/");
-            cairo_show_text(cr, e->components[i]);
+    double room = width - 2 * LABEL_MARGIN;
+    if (height < FONT_SIZE || room <= 0)
+        return;
+
+    /* The name, including any chain folded into e, and size. */
+    struct label *l = label(cr, e);
+    if (l->name_width + l->size_width <= room) {
+        cairo_move_to(cr, x + LABEL_MARGIN, y + height / 2);
+        cairo_show_text(cr, l->text);
+        return;
+    }
+
+    /* Without the size, cut off in place for the moment. */
+    cairo_move_to(cr, x + LABEL_MARGIN, y + height / 2);
+    if (l->name_width <= room) {
+        char c = l->text[l->name_length];
+        l->text[l->name_length] = '\0';
+        cairo_show_text(cr, l->text);
+        l->text[l->name_length] = c;
+        return;
+    }
+
+    /* Too long even so: cut short a copy. */
+    char text[DU_PATH_MAX + 32];
+    size_t len = l->name_length < DU_PATH_MAX ? l->name_length : DU_PATH_MAX;
+    memcpy(text, l->text, len);
+    text[len] = '\0';
+    truncate_label(cr, text, l->name_width, room);
+    cairo_show_text(cr, text);
+}
+
+/*
+ * xdu layout: one column per display level, with each
+ * child given a share of its parent's height proportional
+ * to its size. Children are sorted by decreasing size, so
+ * the first one too small to see ends the column.
+ */
+static void draw_subtree(cairo_t *cr, struct entry *e, int level,
+                         double y, double height) {
+    double column_width = (double) display_width / root_entry->max_depth;
+    struct entry *end = chain_end(e);
+
+    draw_node(cr, e, level * column_width, y, column_width, height);
+    if (e->size == 0)
+        return;
+
+    for (uint32_t i = 0; i < end->n_children; i++) {
+        struct entry *c = end->children[i];
+        double child_height = height * c->size / e->size;
+        if (child_height < 1)
+            break;
+        draw_subtree(cr, c, level + 1, y, child_height);
+        y += child_height;
+    }
+}
+
+static void draw_tree(cairo_t *cr, struct entry *e) {
+    draw_subtree(cr, e, 0, 0, display_height);
+}
+
+/*
+ * Sunburst view. The focused entry is a disk in the center
+ * and each display level below it is a ring, with every
+ * entry's arc given a share of its parent's angle
+ * proportional to its size. The arcs are laid out once per
+ * focus and window size, and merely redrawn otherwise.
+ */
+
+/* Narrowest ring, in pixels; deeper levels are not shown. */
+#define MIN_RING_WIDTH 12
+
+/* Arcs shorter than this many pixels are merged into a "rest" arc. */
+#define MIN_ARC_LENGTH 1.0
+
+struct arc {
+    struct entry *e;          // 0 for the "rest" of a parent's children
+    double a0, a1;            // Angles clockwise from the top
+    uint32_t level;           // Ring; 0 is the center disk
+    uint32_t parent;
+    uint32_t first_child;     // Child arcs are contiguous, by angle
+    uint32_t n_children;
+};
+
+static struct arc *arcs = 0;
+static uint32_t n_arcs = 0, max_arcs = 0;
+
+/* Zoom path: focus_path[n_focus - 1] is in the center. */
+static struct entry *focus_path[DU_COMPONENTS_MAX];
+static int n_focus = 0;
+
+/* What the arcs were laid out for. */
+static struct entry *arcs_focus = 0;
+static double arcs_radius = 0;
+static uint32_t n_rings = 0;
+static double ring_width = 0;
+
+/* Arc under the pointer, or -1. */
+static int64_t hover_arc = -1;
+
+static uint32_t new_arc(struct entry *e, double a0, double a1,
+                        uint32_t level, uint32_t parent) {
+    if (n_arcs >= max_arcs) {
+        max_arcs = max_arcs ? 2 * max_arcs : 4096;
+        arcs = mem_realloc(MEM_GUI, arcs, max_arcs * sizeof(arcs[0]));
+        if (!arcs) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    struct arc *a = &arcs[n_arcs];
+    a->e = e;
+    a->a0 = a0;
+    a->a1 = a1;
+    a->level = level;
+    a->parent = parent;
+    a->first_child = 0;
+    a->n_children = 0;
+    return n_arcs++;
+}
+
+/* Lay out the children of arc i, then their subtrees. */
+static void layout_arc(uint32_t i) {
+    struct entry *e = arcs[i].e;
+    struct entry *end = chain_end(e);
+    uint32_t level = arcs[i].level + 1;
+
+    if (level >= n_rings || e->size == 0)
+        return;
+
+    double a0 = arcs[i].a0;
+    double a1 = arcs[i].a1;
+    double scale = (a1 - a0) / e->size;
+    double outer = (level + 1) * ring_width;
+    uint32_t first = n_arcs;
+    double a = a0;
+    uint64_t rest = 0;
+
+    for (uint32_t k = 0; k < end->n_children; k++) {
+        struct entry *c = end->children[k];
+
+        /* Sorted by decreasing size: the rest are smaller still. */
+        if (rest > 0 || c->size * scale * outer < MIN_ARC_LENGTH) {
+            rest += c->size;
+            continue;
+        }
+        new_arc(c, a, a + c->size * scale, level, i);
+        a += c->size * scale;
+    }
+    if (rest > 0 && rest * scale * outer >= MIN_ARC_LENGTH)
+        new_arc(0, a, a + rest * scale, level, i);
+
+    arcs[i].first_child = first;
+    arcs[i].n_children = n_arcs - first;
+
+    uint32_t last = n_arcs;
+    for (uint32_t j = first; j < last; j++)
+        if (arcs[j].e)
+            layout_arc(j);
+}
+
+/* Recompute the geometry for the current focus and window size. */
+static void layout_sunburst(void) {
+    struct entry *focus = focus_path[n_focus - 1];
+    double radius = fmin(display_width, display_height) / 2.0 - 2;
+
+    if (focus == arcs_focus && radius == arcs_radius)
+        return;
+
+    n_rings = focus->max_depth;
+    if (n_rings * MIN_RING_WIDTH > radius)
+        n_rings = radius / MIN_RING_WIDTH;
+    if (n_rings < 1)
+        n_rings = 1;
+    ring_width = radius / n_rings;
+
+    n_arcs = 0;
+    hover_arc = -1;
+    new_arc(focus, 0, 2 * M_PI, 0, 0);
+    layout_arc(0);
+
+    arcs_focus = focus;
+    arcs_radius = radius;
+}
+
+/*
+ * Find the arc at window position (x, y): the ring gives
+ * the level, and a binary search by angle among each arc's
+ * children leads down to it.
+ */
+static int64_t find_arc(double x, double y) {
+    double dx = x - display_width / 2.0;
+    double dy = y - display_height / 2.0;
+    double r = sqrt(dx * dx + dy * dy);
+    uint32_t level = r / ring_width;
+
+    if (n_arcs == 0 || level >= n_rings)
+        return -1;
+
+    double angle = atan2(dy, dx) + M_PI / 2;
+    if (angle < 0)
+        angle += 2 * M_PI;
+
+    uint32_t i = 0;
+    while (arcs[i].level < level) {
+        uint32_t lo = arcs[i].first_child;
+        uint32_t hi = lo + arcs[i].n_children;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (arcs[mid].a1 <= angle)
+                lo = mid + 1;
+            else
+                hi = mid;
         }
+        if (lo == arcs[i].first_child + arcs[i].n_children ||
+            angle < arcs[lo].a0)
+            return -1;
+        i = lo;
+        if (!arcs[i].e && arcs[i].level < level)
+            return -1;
+    }
+    return i;
+}
+
+/* Write the display label of e, with its size, into buf. */
+static void node_label(struct entry *e, char *buf, size_t n) {
+    struct entry *end = chain_end(e);
+    int first = e->depth == 0 ? 0 : e->n_components - 1;
+    size_t len = snprintf(buf, n, "%s", end->components[first]);
+
+    for (int i = first + 1; i < end->n_components && len < n; i++)
+        len += snprintf(buf + len, n - len, "/%s", end->components[i]);
+    if (len < n)
+        snprintf(buf + len, n - len, " (%" PRIu64 ")", e->size);
+}
+
+static void draw_sunburst(cairo_t *cr) {
+    double cx = display_width / 2.0;
+    double cy = display_height / 2.0;
+
+    layout_sunburst();
+
+    for (uint32_t i = 0; i < n_arcs; i++) {
+        struct arc *a = &arcs[i];
+        double inner = a->level * ring_width;
+        double outer = inner + ring_width;
+
+        cairo_new_path(cr);
+        if (a->level == 0) {
+            cairo_arc(cr, cx, cy, outer, 0, 2 * M_PI);
+        } else {
+            cairo_arc(cr, cx, cy, outer, a->a0 - M_PI / 2, a->a1 - M_PI / 2);
+            cairo_arc_negative(cr, cx, cy, inner,
+                               a->a1 - M_PI / 2, a->a0 - M_PI / 2);
+        }
+        cairo_close_path(cr);
+
+        /* Hue follows the angle; deeper rings are lighter. */
+        double hue = 6 * (a->a0 + a->a1) / (4 * M_PI);
+        double light = 0.45 + 0.5 * a->level / n_rings;
+        double f = hue - floor(hue);
+        double rgb[3];
+        switch ((int) hue % 6) {
+        case 0: rgb[0] = 1; rgb[1] = f; rgb[2] = 0; break;
+        case 1: rgb[0] = 1 - f; rgb[1] = 1; rgb[2] = 0; break;
+        case 2: rgb[0] = 0; rgb[1] = 1; rgb[2] = f; break;
+        case 3: rgb[0] = 0; rgb[1] = 1 - f; rgb[2] = 1; break;
+        case 4: rgb[0] = f; rgb[1] = 0; rgb[2] = 1; break;
+        default: rgb[0] = 1; rgb[1] = 0; rgb[2] = 1 - f; break;
+        }
+        if (!a->e)
+            cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+        else if (a->level == 0 || i == hover_arc)
+            cairo_set_source_rgb(cr, 1, 1, 1);
+        else
+            cairo_set_source_rgb(cr, light + (1 - light) * rgb[0] * 0.5,
+                                 light + (1 - light) * rgb[1] * 0.5,
+                                 light + (1 - light) * rgb[2] * 0.5);
+        cairo_fill_preserve(cr);
+        cairo_set_source_rgb(cr, 0, 0, 0);
+        cairo_stroke(cr);
+    }
+
+    /* Label the focus in the corner, and what is under the pointer. */
+    char label[DU_PATH_MAX + 32];
+    node_label(arcs[0].e, label, sizeof(label));
+    cairo_move_to(cr, 4, 20);
+    cairo_show_text(cr, label);
+    if (hover_arc > 0) {
+        if (arcs[hover_arc].e)
+            node_label(arcs[hover_arc].e, label, sizeof(label));
+        else
+            snprintf(label, sizeof(label), "(smaller entries)");
+        cairo_move_to(cr, 4, 44);
+        cairo_show_text(cr, label);
+    }
+}
+
+/* Highlight the arc under the pointer. */
+static gboolean on_motion_event(GtkWidget *widget, GdkEventMotion *event,
+                                gpointer user_data) {
+    if (!sunburst_view)
+        return FALSE;
+
+    int64_t i = find_arc(event->x, event->y);
+    if (i != hover_arc) {
+        hover_arc = i;
+        gtk_widget_queue_draw(widget);
+    }
+    return TRUE;
+}
+
+/* Click an arc to zoom into it; click the center to zoom out. */
+static gboolean on_button_event(GtkWidget *widget, GdkEventButton *event,
+                                gpointer user_data) {
+    if (!sunburst_view || event->type != GDK_BUTTON_PRESS)
+        return FALSE;
+
+    int64_t i = find_arc(event->x, event->y);
+    if (i == 0 && n_focus > 1) {
+        n_focus--;
+    } else if (i > 0 && arcs[i].e && chain_end(arcs[i].e)->n_children > 0) {
+        /* Extend the zoom path through the arc's ancestors. */
+        uint32_t level = arcs[i].level;
+        for (int64_t k = i; k > 0; k = arcs[k].parent)
+            focus_path[n_focus - 1 + arcs[k].level] = arcs[k].e;
+        n_focus += level;
     } else {
-        cairo_show_text(cr, e->components[e->n_components - 1]);
+        return TRUE;
     }
-    cairo_show_text(cr, " (");
-    cairo_show_text(cr, sizeStr);
-    cairo_show_text(cr, ")");
+    gtk_widget_queue_draw(widget);
+    return TRUE;
 }
 
-static void draw_tree(cairo_t *cr, struct entry *e) {
-    draw_node(cr, e, 0, 0, display_width, display_height);
+/*
+ * s switches views; Escape or Backspace zooms out. d marks
+ * or unmarks the arc under the pointer for deletion, and u
+ * unmarks the last one marked.
+ */
+static gboolean on_key_event(GtkWidget *widget, GdkEventKey *event,
+                             gpointer user_data) {
+    switch (event->keyval) {
+    case GDK_KEY_s:
+        sunburst_view = !sunburst_view;
+        break;
+    case GDK_KEY_d:
+        if (!sunburst_view || hover_arc <= 0 || !arcs[hover_arc].e)
+            return TRUE;
+        plan_toggle(arcs[hover_arc].e);
+        arcs_focus = 0;
+        break;
+    case GDK_KEY_u:
+        if (n_marks == 0)
+            return TRUE;
+        plan_undo();
+        arcs_focus = 0;
+        break;
+    case GDK_KEY_Escape:
+    case GDK_KEY_BackSpace:
+        if (n_focus > 1)
+            n_focus--;
+        break;
+    default:
+        return FALSE;
+    }
+    gtk_widget_queue_draw(GTK_WIDGET(user_data));
+    return TRUE;
+}
+
+/* Draw the chosen view at the current display size. */
+static void draw_view(cairo_t *cr, int sunburst) {
+    /* The font and label caches are made once, on first use. */
+    if (!font) {
+        font = cairo_toy_font_face_create("Helvetica",
+                                          CAIRO_FONT_SLANT_NORMAL,
+                                          CAIRO_FONT_WEIGHT_NORMAL);
+        extents = mem_calloc(MEM_GUI, N_EXTENTS, sizeof(extents[0]));
+        labels = mem_calloc(MEM_GUI, N_LABELS, sizeof(labels[0]));
+        if (!extents || !labels) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+
+    /* Set cairo drawing variables */
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_set_font_face(cr, font);
+    cairo_set_font_size(cr, FONT_SIZE);
+    cairo_set_line_width(cr, 1);
+    cairo_set_line_join(cr, CAIRO_LINE_JOIN_MITER);
+
+    /* Begin drawing the nodes */
+    if (sunburst)
+        draw_sunburst(cr);
+    else
+        draw_tree(cr, root_entry);
+
+    if (n_marks > 0) {
+        char plan[64];
+        snprintf(plan, sizeof(plan), "what-if: %d marked, %" PRIu64 " freed",
+                 n_marks, plan_freed);
+        cairo_set_source_rgb(cr, 0.8, 0, 0);
+        cairo_move_to(cr, 4, display_height - 8);
+        cairo_show_text(cr, plan);
+    }
 }
 
 /* Perform the actual drawing of the entries */
@@ -61,17 +593,8 @@ static void do_drawing(GtkWidget *widget, cairo_t *cr) {
 
     /* Allocation no longer needed */
     g_free(allocation);
-   
-    /* Set cairo drawing variables */
-    cairo_set_source_rgb(cr, 0, 0, 0);
-    cairo_select_font_face(cr, "Helvetica",
-                           CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-    cairo_set_font_size(cr, 20);
-    cairo_set_line_width(cr, 1);
-    cairo_set_line_join(cr, CAIRO_LINE_JOIN_MITER);
-    
-    /* Begin drawing the nodes */
-    draw_tree(cr, root_entry);
+
+    draw_view(cr, sunburst_view);
 }
 
 /* Call up the cairo functionality */
@@ -90,6 +613,43 @@ static void getSize(GtkWidget *widget,
     display_height = allocation->height;
 }
 
+/* Drawing shares the layout and label caches. */
+static pthread_mutex_t render_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Render the whole tree to a PNG file without a window.
+ * The sunburst is drawn unzoomed, from the root. Images
+ * written at once by --output take turns.
+ */
+void render_png(const char *file, int sunburst) {
+    cairo_surface_t *surface =
+        cairo_image_surface_create(CAIRO_FORMAT_RGB24, PNG_WIDTH, PNG_HEIGHT);
+    cairo_t *cr = cairo_create(surface);
+
+    pthread_mutex_lock(&render_lock);
+    display_width = PNG_WIDTH;
+    display_height = PNG_HEIGHT;
+    cairo_set_source_rgb(cr, 1, 1, 1);
+    cairo_paint(cr);
+
+    int saved_focus = n_focus;
+    focus_path[0] = root_entry;
+    n_focus = 1;
+    draw_view(cr, sunburst);
+    n_focus = saved_focus;
+    pthread_mutex_unlock(&render_lock);
+
+    cairo_status_t status = cairo_status(cr);
+    if (status == CAIRO_STATUS_SUCCESS)
+        status = cairo_surface_write_to_png(surface, file);
+    if (status != CAIRO_STATUS_SUCCESS) {
+        fprintf(stderr, "%s: %s\n", file, cairo_status_to_string(status));
+        exit(1);
+    }
+    cairo_destroy(cr);
+    cairo_surface_destroy(surface);
+}
+
 /* Initialize the window, drawing surface, and functionality */
 int gui(int argv, char **argc) {
 
@@ -110,6 +670,17 @@ int gui(int argv, char **argc) {
     g_signal_connect(G_OBJECT(darea), "size-allocate",
                      G_CALLBACK(getSize), NULL);
 
+    /* Hover, click-to-zoom and view switching */
+    focus_path[n_focus++] = root_entry;
+    gtk_widget_add_events(darea, GDK_POINTER_MOTION_MASK |
+                                 GDK_BUTTON_PRESS_MASK);
+    g_signal_connect(G_OBJECT(darea), "motion-notify-event",
+                     G_CALLBACK(on_motion_event), NULL);
+    g_signal_connect(G_OBJECT(darea), "button-press-event",
+                     G_CALLBACK(on_button_event), NULL);
+    g_signal_connect(window, "key-press-event",
+                     G_CALLBACK(on_key_event), darea);
+
     /* Default window settings */
     gtk_window_set_title(GTK_WINDOW(window), "Duvis");
     gtk_window_set_default_size(GTK_WINDOW(window), 600, 480);
@@ -0,0 +1,48 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/* Small non-cryptographic hashes. */
+
+#define HASH_K1 0x9e3779b97f4a7c15ULL
+#define HASH_K2 0xff51afd7ed558ccdULL
+#define HASH_K3 0xc4ceb9fe1a85ec53ULL
+
+/* Finalizer from MurmurHash3: every input bit affects every output bit. */
+static inline uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= HASH_K2;
+    h ^= h >> 33;
+    h *= HASH_K3;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Step a splitmix64 generator; good for filling tables. */
+static inline uint64_t hash_split(uint64_t *state) {
+    *state += HASH_K1;
+    return hash_mix(*state);
+}
+
+/* Hash len bytes a word at a time. */
+static inline uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = data;
+    uint64_t h = seed ^ (len * HASH_K1);
+
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h ^= w * HASH_K2;
+        h = ((h << 31) | (h >> 33)) * HASH_K1;
+        p += 8;
+        len -= 8;
+    }
+
+    uint64_t w = 0;
+    memcpy(&w, p, len);
+    h ^= w * HASH_K3;
+    return hash_mix(h);
+}
@@ -0,0 +1,711 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Streamed input, from a file, a pipe or a du run directly
+ * on an enlarged pipe. Reading, line splitting and entry
+ * building overlap with each other and with du's traversal.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "duvis.h"
+#include "mem.h"
+#include "pool.h"
+
+/* Ask for a pipe this big; Linux caps it at pipe-max-size. */
+#define DU_PIPE_SIZE (1024 * 1024)
+
+/*
+ * Streamed input runs as three stages: a block reader, a
+ * line tokenizer and an entry builder. Each stage hands
+ * large batches to the next through a bounded lock-free
+ * single-producer single-consumer queue, so with threads to
+ * spare the stages overlap and the slowest one sets the
+ * pace.
+ */
+
+#define BLOCK_LENGTH (1024 * 1024)
+#define BATCH_LINES 4096
+
+/* Slots per queue; bounds how far a stage can run ahead. */
+#define SPSC_LENGTH 8
+
+/* Polls of an empty or full queue before yielding the CPU. */
+#define SPSC_SPINS 256
+
+struct block {
+    size_t length;            // 0 marks end of input
+    char data[];              // BLOCK_LENGTH + 1, for a final terminator
+};
+
+struct batch {
+    int n_lines;              // 0 marks end of input
+    char *lines[BATCH_LINES];
+};
+
+/*
+ * The producer owns head and the consumer owns tail; each
+ * only reads the other's, so no locks are needed.
+ */
+struct spsc {
+    void *slots[SPSC_LENGTH];
+    unsigned head __attribute__((aligned(64)));
+    unsigned tail __attribute__((aligned(64)));
+};
+
+static void spsc_wait(int *spins) {
+    if (++*spins < SPSC_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+static void spsc_push(struct spsc *q, void *p) {
+    unsigned head = q->head;
+    int spins = 0;
+
+    while (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) ==
+           SPSC_LENGTH)
+        spsc_wait(&spins);
+    q->slots[head % SPSC_LENGTH] = p;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *spsc_pop(struct spsc *q) {
+    unsigned tail = q->tail;
+    int spins = 0;
+
+    while (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail)
+        spsc_wait(&spins);
+    void *p = q->slots[tail % SPSC_LENGTH];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+static pid_t du_pid = -1;
+
+/* Start du on argv, writing to a pipe; returns the read end. */
+static int spawn(char **argv, pid_t *pid) {
+    int fds[2];
+
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+
+    /* Best effort: a smaller pipe only costs more wakeups. */
+    fcntl(fds[1], F_SETPIPE_SZ, DU_PIPE_SIZE);
+
+    *pid = fork();
+    if (*pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (*pid == 0) {
+        if (dup2(fds[1], 1) == -1) {
+            perror("dup2");
+            _exit(127);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        execvp("du", argv);
+        perror("du");
+        _exit(127);
+    }
+
+    close(fds[1]);
+    return fds[0];
+}
+
+/* Reap a du and pass on any complaint about its exit. */
+static void reap(pid_t pid) {
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid");
+            exit(1);
+        }
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+        exit(1);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fprintf(stderr, "warning: du exited abnormally; "
+                "the tree may be incomplete\n");
+}
+
+/*
+ * Start du with the given arguments, writing to a pipe;
+ * returns the read end.
+ */
+int du_spawn(char **args, int n_args) {
+    char **argv = mem_malloc(MEM_INPUT, (n_args + 2) * sizeof(argv[0]));
+    if (!argv) {
+        perror("malloc");
+        exit(1);
+    }
+    argv[0] = "du";
+    memcpy(&argv[1], args, n_args * sizeof(argv[0]));
+    argv[n_args + 1] = 0;
+
+    int fd = spawn(argv, &du_pid);
+    mem_free(MEM_INPUT, argv);
+    return fd;
+}
+
+void du_wait(void) {
+    if (du_pid == -1)
+        return;
+    reap(du_pid);
+    du_pid = -1;
+}
+
+/* Stage 1: read the next block, or an empty one at the end. */
+static struct block *read_block(int fd) {
+    struct block *b = mem_malloc(MEM_PATHS, sizeof(*b) + BLOCK_LENGTH + 1);
+    if (!b) {
+        perror("malloc");
+        exit(1);
+    }
+
+    /* Fill the block, so lines rarely straddle two. */
+    b->length = 0;
+    while (b->length < BLOCK_LENGTH) {
+        ssize_t n = read(fd, b->data + b->length, BLOCK_LENGTH - b->length);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            perror("read");
+            exit(1);
+        }
+        if (n == 0)
+            break;
+        b->length += n;
+    }
+    mem_slack(MEM_PATHS, BLOCK_LENGTH - b->length);
+    return b;
+}
+
+/*
+ * Stage 2 state. Blocks are never freed: the lines are
+ * terminated in place and become the entry paths.
+ */
+struct tokenizer {
+    char term;
+    char *carry;              // A line the last block cut off
+    size_t n_carry;
+    struct batch *batch;      // Being filled
+    struct batch *(*flush)(struct batch *full);
+};
+
+static void tokenize_line(struct tokenizer *t, char *line) {
+    struct batch *b = t->batch;
+
+    b->lines[b->n_lines++] = line;
+    if (b->n_lines == BATCH_LINES)
+        t->batch = t->flush(b);
+}
+
+/* Stage 2: split a block into lines. */
+static void tokenize_block(struct tokenizer *t, struct block *b) {
+    char *line = b->data;
+    char *end = b->data + b->length;
+
+    /* At the end, a leftover line is terminated in its block. */
+    if (b->length == 0) {
+        if (t->n_carry > 0) {
+            fprintf(stderr, "warning: unterminated final path\n");
+            t->carry[t->n_carry] = '\0';
+            tokenize_line(t, t->carry);
+        }
+        return;
+    }
+
+    while (line < end) {
+        char *eol = memchr(line, t->term, end - line);
+
+        /* A line cut off by the end of the block waits for the rest. */
+        if (!eol) {
+            if (t->n_carry > 0) {
+                fprintf(stderr, "path buffer overrun\n");
+                exit(1);
+            }
+            t->carry = line;
+            t->n_carry = end - line;
+            return;
+        }
+
+        if (t->n_carry > 0) {
+            size_t n = eol - line;
+            char *joined = mem_malloc(MEM_PATHS, t->n_carry + n + 1);
+            if (!joined) {
+                perror("malloc");
+                exit(1);
+            }
+            memcpy(joined, t->carry, t->n_carry);
+            memcpy(joined + t->n_carry, line, n);
+            joined[t->n_carry + n] = '\0';
+            mem_slack(MEM_PATHS, t->n_carry);
+            t->n_carry = 0;
+            tokenize_line(t, joined);
+        } else {
+            *eol = '\0';
+            tokenize_line(t, line);
+        }
+        line = eol + 1;
+    }
+}
+
+/* Stage 3 state. */
+static void (*build_added)(int i);
+static int build_line_number;
+
+/* Stage 3: make and parse an entry for each line. */
+static void build_batch(struct batch *b) {
+    for (int i = 0; i < b->n_lines; i++) {
+        struct entry *e = new_entry();
+        e->path = b->lines[i];
+        parse_entry(e, ++build_line_number);
+        if (build_added)
+            build_added(n_entries - 1);
+    }
+}
+
+/* With one thread, each batch is built as soon as it fills. */
+static struct batch *flush_inline(struct batch *full) {
+    build_batch(full);
+    full->n_lines = 0;
+    return full;
+}
+
+static struct spsc blocks_q, lines_q, free_q;
+
+/*
+ * Batches circulate between the tokenizer and the builder.
+ * The tokenizer always holds one, so the rest fit in free_q.
+ */
+#define N_BATCHES SPSC_LENGTH
+
+static struct batch *flush_queued(struct batch *full) {
+    spsc_push(&lines_q, full);
+    struct batch *b = spsc_pop(&free_q);
+    b->n_lines = 0;
+    return b;
+}
+
+static void *reader(void *arg) {
+    int fd = (intptr_t) arg;
+
+    while (1) {
+        struct block *b = read_block(fd);
+        spsc_push(&blocks_q, b);
+        if (b->length == 0)
+            return 0;
+    }
+}
+
+static void *tokenizer(void *arg) {
+    struct tokenizer *t = arg;
+
+    while (1) {
+        struct block *b = spsc_pop(&blocks_q);
+        tokenize_block(t, b);
+        if (b->length == 0) {
+            mem_slack(MEM_PATHS, -BLOCK_LENGTH);
+            mem_free(MEM_PATHS, b);
+            /* An empty batch tells the builder we are done. */
+            if (t->batch->n_lines > 0)
+                t->batch = flush_queued(t->batch);
+            spsc_push(&lines_q, t->batch);
+            return 0;
+        }
+    }
+}
+
+/*
+ * Read du output from fd into the entry table, calling
+ * added(i) as each entries[i] is parsed, if added is set.
+ * With more than one thread in the pool, the reader and
+ * tokenizer get threads of their own.
+ */
+void stream_entries(int fd, int zeroflag, void (*added)(int i)) {
+    struct tokenizer t = {zeroflag ? '\0' : '\n', 0, 0, 0, 0};
+
+    build_added = added;
+    build_line_number = 0;
+
+    if (pool_threads == 1) {
+        t.batch = mem_malloc(MEM_INPUT, sizeof(*t.batch));
+        if (!t.batch) {
+            perror("malloc");
+            exit(1);
+        }
+        t.batch->n_lines = 0;
+        t.flush = flush_inline;
+        while (1) {
+            struct block *b = read_block(fd);
+            tokenize_block(&t, b);
+            if (b->length == 0) {
+                mem_slack(MEM_PATHS, -BLOCK_LENGTH);
+            mem_free(MEM_PATHS, b);
+                break;
+            }
+        }
+        build_batch(t.batch);
+        mem_free(MEM_INPUT, t.batch);
+    } else {
+        struct batch *batches =
+            mem_malloc(MEM_INPUT, N_BATCHES * sizeof(batches[0]));
+        if (!batches) {
+            perror("malloc");
+            exit(1);
+        }
+        t.batch = &batches[0];
+        t.batch->n_lines = 0;
+        t.flush = flush_queued;
+        for (int i = 1; i < N_BATCHES; i++)
+            spsc_push(&free_q, &batches[i]);
+
+        pthread_t threads[2];
+        if (pthread_create(&threads[0], 0, reader, (void *) (intptr_t) fd) ||
+            pthread_create(&threads[1], 0, tokenizer, &t)) {
+            perror("pthread_create");
+            exit(1);
+        }
+
+        while (1) {
+            struct batch *b = spsc_pop(&lines_q);
+            if (b->n_lines == 0)
+                break;
+            build_batch(b);
+            spsc_push(&free_q, b);
+        }
+
+        pthread_join(threads[0], 0);
+        pthread_join(threads[1], 0);
+        mem_free(MEM_INPUT, batches);
+        /* Leave the queues empty for another run. */
+        while (free_q.head != free_q.tail)
+            spsc_pop(&free_q);
+    }
+
+    close(fd);
+    trim_entries();
+}
+
+/*
+ * Fan-out: one du per top-level directory, up to a limit at
+ * a time, with each finished stream parsed on the pool
+ * while the rest are still running.
+ */
+
+#define FANOUT_READ_LENGTH (64 * 1024)
+
+struct stream {
+    char *path;               // The directory given to this du
+    uint64_t weight;          // Guess at its size, for ordering
+    pid_t pid;
+    int fd;
+    char *text;               // Everything du wrote
+    size_t n_text, max_text;
+    struct entry *entries;    // Parsed from text
+    int n_entries;
+    int zeroflag;
+    struct task task;
+};
+
+static void parse_stream_range(size_t start, size_t end, void *arg) {
+    struct stream *s = arg;
+
+    for (size_t i = start; i < end; i++)
+        parse_entry(&s->entries[i], i + 1);
+}
+
+/* Split a finished stream into lines and parse them. */
+static void parse_stream(void *arg) {
+    struct stream *s = arg;
+    char term = s->zeroflag ? '\0' : '\n';
+    int n_lines = 0;
+
+    /* Make sure the last line is terminated. */
+    if (s->n_text > 0 && s->text[s->n_text - 1] != term) {
+        fprintf(stderr, "warning: unterminated final path\n");
+        s->text[s->n_text++] = term;
+    }
+    for (size_t i = 0; i < s->n_text; i++)
+        if (s->text[i] == term)
+            n_lines++;
+
+    s->entries = mem_malloc(MEM_ENTRIES, n_lines * sizeof(s->entries[0]) + 1);
+    if (!s->entries) {
+        perror("malloc");
+        exit(1);
+    }
+
+    /* Entry paths point straight into the stream text. */
+    char *line = s->text;
+    for (int i = 0; i < n_lines; i++) {
+        char *eol = memchr(line, term, s->text + s->n_text - line);
+        *eol = '\0';
+        struct entry *e = &s->entries[i];
+        e->path = line;
+        e->n_children = 0;
+        e->n_chain = 0;
+        e->children = 0;
+        line = eol + 1;
+    }
+    s->n_entries = n_lines;
+    mem_slack(MEM_PATHS, s->max_text - s->n_text);
+    pool_for(0, n_lines, 0, parse_stream_range, s);
+}
+
+/* A multiply-linked file directly in the fan-out root. */
+struct link {
+    dev_t dev;
+    ino_t ino;
+    uint64_t blocks;
+};
+
+static int compare_links(const void *p1, const void *p2) {
+    const struct link *l1 = p1;
+    const struct link *l2 = p2;
+
+    if (l1->dev != l2->dev)
+        return l1->dev < l2->dev ? -1 : 1;
+    if (l1->ino != l2->ino)
+        return l1->ino < l2->ino ? -1 : 1;
+    return 0;
+}
+
+/* Largest guess first, so the long runs start early. */
+static int compare_weights(const void *p1, const void *p2) {
+    struct stream * const *s1 = p1;
+    struct stream * const *s2 = p2;
+
+    if ((*s1)->weight > (*s2)->weight)
+        return -1;
+    if ((*s1)->weight < (*s2)->weight)
+        return 1;
+    return 0;
+}
+
+/*
+ * Read the stream that fd is ready on. Returns 0 at end of
+ * input.
+ */
+static int fill_stream(struct stream *s) {
+    /* One spare byte for parse_stream() to terminate with. */
+    if (s->n_text + FANOUT_READ_LENGTH + 1 > s->max_text) {
+        s->max_text = 2 * (s->n_text + FANOUT_READ_LENGTH + 1);
+        s->text = mem_realloc(MEM_PATHS, s->text, s->max_text);
+        if (!s->text) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    ssize_t n = read(s->fd, s->text + s->n_text, FANOUT_READ_LENGTH);
+    if (n == -1) {
+        if (errno == EINTR || errno == EAGAIN)
+            return 1;
+        perror("read");
+        exit(1);
+    }
+    s->n_text += n;
+    return n > 0;
+}
+
+/*
+ * Run du over each directory directly in dir, at most
+ * n_procs at a time, and make the combined entry table
+ * that a single du of dir would have given.
+ */
+void fanout_entries(const char *dir, int n_procs, int zeroflag) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        exit(1);
+    }
+
+    struct stat st;
+    if (fstat(dirfd(d), &st) == -1) {
+        perror(dir);
+        exit(1);
+    }
+
+    /*
+     * The root's own total is its children's plus whatever
+     * is not in a subdirectory, which du counts in 512-byte
+     * blocks and reports in kilobytes.
+     */
+    uint64_t own_blocks = st.st_blocks;
+    struct link *links = 0;
+    int n_links = 0, max_links = 0;
+    struct stream *streams = 0;
+    int n_streams = 0, max_streams = 0;
+    size_t n_dir = strlen(dir);
+    int slash = n_dir > 0 && dir[n_dir - 1] == '/';
+    struct dirent *de;
+
+    while ((de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            fprintf(stderr, "%s/%s: %s\n", dir, de->d_name, strerror(errno));
+            continue;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            /* du counts each multiply-linked file only once. */
+            if (st.st_nlink > 1) {
+                if (n_links >= max_links) {
+                    max_links = max_links ? 2 * max_links : 64;
+                    links = mem_realloc(MEM_INPUT, links,
+                                        max_links * sizeof(links[0]));
+                    if (!links) {
+                        perror("realloc");
+                        exit(1);
+                    }
+                }
+                links[n_links].dev = st.st_dev;
+                links[n_links].ino = st.st_ino;
+                links[n_links].blocks = st.st_blocks;
+                n_links++;
+            } else {
+                own_blocks += st.st_blocks;
+            }
+            continue;
+        }
+
+        if (n_streams >= max_streams) {
+            max_streams = max_streams ? 2 * max_streams : 64;
+            streams = mem_realloc(MEM_INPUT, streams,
+                                  max_streams * sizeof(streams[0]));
+            if (!streams) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        struct stream *s = &streams[n_streams++];
+        memset(s, 0, sizeof(*s));
+        s->path = mem_malloc(MEM_INPUT, n_dir + strlen(de->d_name) + 2);
+        if (!s->path) {
+            perror("malloc");
+            exit(1);
+        }
+        sprintf(s->path, "%s%s%s", dir, slash ? "" : "/", de->d_name);
+        /* Link count tracks the number of subdirectories. */
+        s->weight = ((uint64_t) st.st_nlink << 32) + st.st_size;
+        s->fd = -1;
+        s->zeroflag = zeroflag;
+    }
+    closedir(d);
+
+    qsort(links, n_links, sizeof(links[0]), compare_links);
+    for (int i = 0; i < n_links; i++)
+        if (i == 0 || compare_links(&links[i - 1], &links[i]))
+            own_blocks += links[i].blocks;
+    mem_free(MEM_INPUT, links);
+
+    struct stream **queue =
+        mem_malloc(MEM_INPUT, n_streams * sizeof(queue[0]) + 1);
+    struct pollfd *fds = mem_malloc(MEM_INPUT, n_procs * sizeof(fds[0]));
+    struct stream **running =
+        mem_malloc(MEM_INPUT, n_procs * sizeof(running[0]));
+    if (!queue || !fds || !running) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < n_streams; i++)
+        queue[i] = &streams[i];
+    qsort(queue, n_streams, sizeof(queue[0]), compare_weights);
+
+    int next = 0, n_running = 0;
+    while (next < n_streams || n_running > 0) {
+        while (n_running < n_procs && next < n_streams) {
+            struct stream *s = queue[next++];
+            char *zero_argv[] = {"du", "-0", "--", s->path, 0};
+            char *line_argv[] = {"du", "--", s->path, 0};
+            char **argv = zeroflag ? zero_argv : line_argv;
+            s->fd = spawn(argv, &s->pid);
+            running[n_running] = s;
+            fds[n_running].fd = s->fd;
+            fds[n_running].events = POLLIN;
+            n_running++;
+        }
+
+        if (poll(fds, n_running, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+
+        for (int i = 0; i < n_running; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            struct stream *s = running[i];
+            if (fill_stream(s))
+                continue;
+
+            close(s->fd);
+            reap(s->pid);
+            pool_fork(&s->task, parse_stream, s);
+
+            /* Fill the hole from the end and look at it again. */
+            n_running--;
+            running[i] = running[n_running];
+            fds[i] = fds[n_running];
+            i--;
+        }
+    }
+    mem_free(MEM_INPUT, queue);
+    mem_free(MEM_INPUT, fds);
+    mem_free(MEM_INPUT, running);
+
+    /* Stitch the streams together in directory order. */
+    uint64_t total = (own_blocks + 1) / 2;
+    for (int i = 0; i < n_streams; i++) {
+        struct stream *s = &streams[i];
+        pool_join(&s->task);
+        for (int j = 0; j < s->n_entries; j++)
+            *new_entry() = s->entries[j];
+        if (s->n_entries > 0)
+            total += s->entries[s->n_entries - 1].size;
+        mem_free(MEM_ENTRIES, s->entries);
+        mem_free(MEM_INPUT, s->path);
+    }
+    mem_free(MEM_INPUT, streams);
+
+    char line[DU_PATH_MAX + 32];
+    int n_line = snprintf(line, sizeof(line), "%" PRIu64 "\t%s", total, dir);
+    if (n_line >= sizeof(line)) {
+        fprintf(stderr, "%s: path buffer overrun\n", dir);
+        exit(1);
+    }
+    add_line(line, n_line, n_entries + 1);
+    trim_entries();
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * LD_PRELOAD shim that makes a fast file system act slow,
+ * for benchmarking scans without the real storage. Each
+ * directory read, stat and open first sleeps for
+ * $DUVIS_LATENCY microseconds plus up to $DUVIS_JITTER
+ * more, chosen at random. Directory reads made through
+ * readdir() do not go through getdents64() by symbol, so
+ * opening a directory stream pays for its first read.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+static long latency_us = 0, jitter_us = 0;
+
+__attribute__((constructor))
+static void latency_init(void) {
+    char *s = getenv("DUVIS_LATENCY");
+    if (s)
+        latency_us = atol(s);
+    s = getenv("DUVIS_JITTER");
+    if (s)
+        jitter_us = atol(s);
+}
+
+static void delay(void) {
+    static __thread uint64_t state;
+    long us = latency_us;
+
+    if (jitter_us > 0) {
+        if (state == 0)
+            state = (uintptr_t) &state ^ (uint64_t) getpid() << 32;
+        us += hash_split(&state) % (jitter_us + 1);
+    }
+    if (us > 0) {
+        struct timespec ts = {us / 1000000, us % 1000000 * 1000};
+        while (nanosleep(&ts, &ts) == -1)
+            ;
+    }
+}
+
+/* Find the next definition of name, once. */
+#define REAL(name) \
+    static __typeof__(name) *real_##name; \
+    if (!real_##name) \
+        real_##name = (__typeof__(name) *) dlsym(RTLD_NEXT, #name)
+
+ssize_t getdents64(int fd, void *buf, size_t n) {
+    REAL(getdents64);
+    delay();
+    return real_getdents64(fd, buf, n);
+}
+
+DIR *opendir(const char *path) {
+    REAL(opendir);
+    delay();
+    return real_opendir(path);
+}
+
+DIR *fdopendir(int fd) {
+    REAL(fdopendir);
+    delay();
+    return real_fdopendir(fd);
+}
+
+int statx(int dirfd, const char *path, int flags, unsigned int mask,
+          struct statx *buf) {
+    REAL(statx);
+    delay();
+    return real_statx(dirfd, path, flags, mask, buf);
+}
+
+int stat(const char *path, struct stat *buf) {
+    REAL(stat);
+    delay();
+    return real_stat(path, buf);
+}
+
+int lstat(const char *path, struct stat *buf) {
+    REAL(lstat);
+    delay();
+    return real_lstat(path, buf);
+}
+
+int fstatat(int dirfd, const char *path, struct stat *buf, int flags) {
+    REAL(fstatat);
+    delay();
+    return real_fstatat(dirfd, path, buf, flags);
+}
+
+int fstatat64(int dirfd, const char *path, struct stat64 *buf, int flags) {
+    REAL(fstatat64);
+    delay();
+    return real_fstatat64(dirfd, path, buf, flags);
+}
+
+int lstat64(const char *path, struct stat64 *buf) {
+    REAL(lstat64);
+    delay();
+    return real_lstat64(path, buf);
+}
+
+/* The mode is only there with O_CREAT or O_TMPFILE. */
+static mode_t open_mode(int flags, va_list ap) {
+    if (flags & (O_CREAT | O_TMPFILE))
+        return va_arg(ap, mode_t);
+    return 0;
+}
+
+int open(const char *path, int flags, ...) {
+    va_list ap;
+    REAL(open);
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    delay();
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) {
+    va_list ap;
+    REAL(open64);
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    delay();
+    return real_open64(path, flags, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    va_list ap;
+    REAL(openat);
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    delay();
+    return real_openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...) {
+    va_list ap;
+    REAL(openat64);
+    va_start(ap, flags);
+    mode_t mode = open_mode(flags, ap);
+    va_end(ap);
+    delay();
+    return real_openat64(dirfd, path, flags, mode);
+}
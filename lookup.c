@@ -0,0 +1,180 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Batch lookup of many paths at once. The stable IDs of
+ * all the entries, hashes of their paths, are computed in
+ * parallel into one open-addressed index, and so are those
+ * of the queries; each query then costs a probe or two and
+ * a component compare, rather than a pass over the du
+ * text. Empty components are skipped, so /var/lib and
+ * var/lib are the same path.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "duvis.h"
+#include "mem.h"
+#include "pool.h"
+
+#define LOOKUP_READ_LENGTH (1024 * 1024)
+
+static uint64_t *hashes = 0;          // By entry
+static uint32_t *slots = 0;           // Entry index + 1, or 0 if empty
+static uint64_t mask = 0;
+static uint32_t *n_below = 0;         // Descendants, by entry
+
+struct query {
+    char *path;
+    struct entry *e;
+};
+
+static struct query *queries = 0;
+static size_t n_queries = 0;
+
+static void *lookup_alloc(void *p, size_t size) {
+    p = mem_realloc(MEM_OUTPUT, p, size);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static int same_path(struct entry *e, const char *path) {
+    uint32_t i = 0;
+
+    for (;;) {
+        while (i < e->n_components && !e->components[i][0])
+            i++;
+        while (*path == '/')
+            path++;
+        if (i == e->n_components || !*path)
+            return i == e->n_components && !*path;
+        size_t len = strcspn(path, "/");
+        if (strncmp(e->components[i], path, len) ||
+            e->components[i][len] != '\0')
+            return 0;
+        i++;
+        path += len;
+    }
+}
+
+static void hash_entries(size_t start, size_t end, void *arg) {
+    for (size_t i = start; i < end; i++)
+        hashes[i] = entry_id(&entries[i]);
+}
+
+static void resolve_range(size_t start, size_t end, void *arg) {
+    for (size_t q = start; q < end; q++) {
+        uint64_t h = path_id(queries[q].path);
+        queries[q].e = 0;
+        for (uint64_t i = h & mask; slots[i]; i = (i + 1) & mask) {
+            struct entry *e = &entries[slots[i] - 1];
+            if (hashes[slots[i] - 1] == h && same_path(e, queries[q].path)) {
+                queries[q].e = e;
+                break;
+            }
+        }
+    }
+}
+
+static uint32_t count_below(struct entry *e) {
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < e->n_children; i++)
+        n += 1 + count_below(e->children[i]);
+    n_below[e - entries] = n;
+    return n;
+}
+
+/*
+ * Read paths from file (- for standard input), one per
+ * line, and print the size, depth and number of descendants
+ * of each, in the order given, or dashes if it is not in
+ * the tree. Call before chains are collapsed.
+ */
+void lookup_paths(FILE *out, const char *file, int zeroflag) {
+    FILE *f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+    char term = zeroflag ? '\0' : '\n';
+    size_t max_queries = 0, n_text = 0, max_text = 0, n;
+    char *text = 0;
+
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    do {
+        if (n_text + LOOKUP_READ_LENGTH + 1 > max_text) {
+            max_text = 2 * (n_text + LOOKUP_READ_LENGTH + 1);
+            text = lookup_alloc(text, max_text);
+        }
+        n = fread(text + n_text, 1, LOOKUP_READ_LENGTH, f);
+        n_text += n;
+    } while (n > 0);
+    if (ferror(f)) {
+        perror(file);
+        exit(1);
+    }
+    if (f != stdin)
+        fclose(f);
+
+    /* A missing last terminator is fine. */
+    if (n_text > 0 && text[n_text - 1] != term)
+        text[n_text++] = term;
+    for (char *line = text, *end; line < text + n_text; line = end + 1) {
+        end = memchr(line, term, text + n_text - line);
+        *end = '\0';
+        if (n_queries >= max_queries) {
+            max_queries = max_queries ? 2 * max_queries : 1024;
+            queries = lookup_alloc(queries, max_queries * sizeof(queries[0]));
+        }
+        queries[n_queries++].path = line;
+    }
+
+    uint64_t n_slots = 1024;
+    while (n_slots < 2 * (uint64_t) n_entries)
+        n_slots *= 2;
+    mask = n_slots - 1;
+    slots = mem_calloc(MEM_OUTPUT, n_slots, sizeof(slots[0]));
+    hashes = lookup_alloc(0, (n_entries + 1) * sizeof(hashes[0]));
+    n_below = lookup_alloc(0, (n_entries + 1) * sizeof(n_below[0]));
+    if (!slots) {
+        perror("calloc");
+        exit(1);
+    }
+
+    pool_for(0, n_entries, 0, hash_entries, 0);
+    for (int i = 0; i < n_entries; i++) {
+        uint64_t j = hashes[i] & mask;
+        while (slots[j])
+            j = (j + 1) & mask;
+        slots[j] = i + 1;
+    }
+    count_below(root_entry);
+    pool_for(0, n_queries, 0, resolve_range, 0);
+
+    for (size_t q = 0; q < n_queries; q++) {
+        struct entry *e = queries[q].e;
+        if (e)
+            fprintf(out, "%" PRIu64 "\t%" PRIu32 "\t%" PRIu32 "\t%s\n",
+                    e->size, e->depth, n_below[e - entries], queries[q].path);
+        else
+            fprintf(out, "-\t-\t-\t%s\n", queries[q].path);
+    }
+
+    mem_free(MEM_OUTPUT, text);
+    mem_free(MEM_OUTPUT, queries);
+    mem_free(MEM_OUTPUT, slots);
+    mem_free(MEM_OUTPUT, hashes);
+    mem_free(MEM_OUTPUT, n_below);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Tagged allocation wrappers. Sizes are taken from the
+ * allocator itself, so no header is added to any block and
+ * the counts include malloc's own rounding.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <malloc.h>
+
+#include "mem.h"
+
+struct mem_stats {
+    int64_t live;
+    int64_t peak;
+    int64_t n_allocs;
+    int64_t slack;
+};
+
+static char *mem_names[N_MEM_TAGS] = {
+    "paths", "components", "entries", "children", "input",
+    "cache", "sort", "pool", "output", "gui", "fleet", "scan",
+};
+
+int mem_accounting = 0;
+
+static struct mem_stats stats[N_MEM_TAGS];
+static struct mem_stats total;
+
+static void raise_peak(int64_t *peak, int64_t live) {
+    int64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > old &&
+           !__atomic_compare_exchange_n(peak, &old, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void account(enum mem_tag tag, int64_t delta, int n_allocs) {
+    struct mem_stats *s = &stats[tag];
+
+    int64_t live = __atomic_add_fetch(&s->live, delta, __ATOMIC_RELAXED);
+    int64_t all = __atomic_add_fetch(&total.live, delta, __ATOMIC_RELAXED);
+    if (n_allocs) {
+        __atomic_add_fetch(&s->n_allocs, n_allocs, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&total.n_allocs, n_allocs, __ATOMIC_RELAXED);
+    }
+    if (delta > 0) {
+        raise_peak(&s->peak, live);
+        raise_peak(&total.peak, all);
+    }
+}
+
+void *mem_malloc(enum mem_tag tag, size_t size) {
+    void *p = malloc(size);
+
+    if (p && mem_accounting)
+        account(tag, malloc_usable_size(p), 1);
+    return p;
+}
+
+void *mem_calloc(enum mem_tag tag, size_t n, size_t size) {
+    void *p = calloc(n, size);
+
+    if (p && mem_accounting)
+        account(tag, malloc_usable_size(p), 1);
+    return p;
+}
+
+void *mem_realloc(enum mem_tag tag, void *p, size_t size) {
+    if (!mem_accounting)
+        return realloc(p, size);
+
+    int64_t old = p ? malloc_usable_size(p) : 0;
+    void *q = realloc(p, size);
+
+    if (q)
+        account(tag, (int64_t) malloc_usable_size(q) - old, !p);
+    return q;
+}
+
+void mem_free(enum mem_tag tag, void *p) {
+    if (p && mem_accounting)
+        account(tag, -(int64_t) malloc_usable_size(p), 0);
+    free(p);
+}
+
+void mem_slack(enum mem_tag tag, int64_t delta) {
+    if (mem_accounting) {
+        __atomic_add_fetch(&stats[tag].slack, delta, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&total.slack, delta, __ATOMIC_RELAXED);
+    }
+}
+
+static void report_line(FILE *out, char *name, struct mem_stats *s) {
+    fprintf(out, "%-12s %14" PRId64 " %14" PRId64 " %12" PRId64
+            " %14" PRId64 "\n", name, s->live, s->peak, s->n_allocs,
+            s->slack);
+}
+
+/*
+ * The total peak is the high-water mark of the sum, which
+ * is less than the sum of the per-tag peaks.
+ */
+void mem_report(FILE *out) {
+    fprintf(out, "%-12s %14s %14s %12s %14s\n",
+            "memory", "live", "peak", "allocs", "slack");
+    for (int i = 0; i < N_MEM_TAGS; i++)
+        report_line(out, mem_names[i], &stats[i]);
+    report_line(out, "total", &total);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Memory accounting. Allocations go through these wrappers
+ * tagged with the subsystem they belong to; with accounting
+ * on, live and peak bytes and allocation counts are kept
+ * per tag. They return 0 on failure, as malloc() does.
+ */
+
+enum mem_tag {
+    MEM_PATHS,                // Line text, which the entries point into
+    MEM_COMPONENTS,           // Per-entry component arrays
+    MEM_ENTRIES,              // The entry table
+    MEM_CHILDREN,             // Children arrays and builder scratch
+    MEM_INPUT,                // Reader and fan-out buffers
+    MEM_CACHE,                // --cache chunk tables and buffers
+    MEM_SORT,                 // Merge sort scratch
+    MEM_POOL,                 // Thread pool deques
+    MEM_OUTPUT,               // Output formatting
+    MEM_GUI,                  // Sunburst layout
+    MEM_FLEET,                // --fleet names and host trees
+    MEM_SCAN,                 // --scan directory tree and journal
+    N_MEM_TAGS
+};
+
+/* Set before the first allocation to turn accounting on. */
+extern int mem_accounting;
+
+extern void *mem_malloc(enum mem_tag tag, size_t size);
+extern void *mem_calloc(enum mem_tag tag, size_t n, size_t size);
+extern void *mem_realloc(enum mem_tag tag, void *p, size_t size);
+extern void mem_free(enum mem_tag tag, void *p);
+
+/* Note bytes that are allocated but known to be unused. */
+extern void mem_slack(enum mem_tag tag, int64_t delta);
+
+/* Print the per-tag table. */
+extern void mem_report(FILE *out);
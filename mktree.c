@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Make a synthetic directory tree to scan, best on tmpfs:
+ * every directory down to the given depth has the same
+ * number of subdirectories and files. A share of the files
+ * are hard links to an earlier file, and a share are
+ * sparse, with a large length and no data. The seed makes
+ * the same tree every time.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+#define MKTREE_PATH_MAX 4096
+
+/* Length of a sparse file, in bytes. */
+#define MKTREE_SPARSE_LENGTH (64 * 1024 * 1024)
+
+static int depth = 4, fanout = 8, n_files = 16;
+static int link_percent = 0, sparse_percent = 0;
+static size_t file_length = 0;
+static uint64_t seed = 1;
+static char *contents;
+
+static uint64_t n_dirs_made = 0, n_files_made = 0, n_links_made = 0;
+static uint64_t n_sparse_made = 0;
+static char last_file[MKTREE_PATH_MAX];
+
+static int chance(int percent) {
+    return hash_split(&seed) % 100 < (uint64_t) percent;
+}
+
+static void fail(const char *path) {
+    perror(path);
+    exit(1);
+}
+
+static void make_file(const char *path) {
+    if (last_file[0] && chance(link_percent)) {
+        if (link(last_file, path) == -1)
+            fail(path);
+        n_links_made++;
+        return;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        fail(path);
+    if (chance(sparse_percent)) {
+        if (ftruncate(fd, MKTREE_SPARSE_LENGTH) == -1)
+            fail(path);
+        n_sparse_made++;
+    } else if (file_length > 0 &&
+               write(fd, contents, file_length) != (ssize_t) file_length) {
+        fail(path);
+    }
+    if (close(fd) == -1)
+        fail(path);
+    strcpy(last_file, path);
+    n_files_made++;
+}
+
+static void make_dir(char *path, size_t len, int level) {
+    if (mkdir(path, 0755) == -1 && !(level == 0 && errno == EEXIST))
+        fail(path);
+    n_dirs_made++;
+
+    for (int i = 0; i < n_files; i++) {
+        snprintf(path + len, MKTREE_PATH_MAX - len, "/f%d", i);
+        make_file(path);
+    }
+    if (level < depth)
+        for (int i = 0; i < fanout; i++) {
+            int n = snprintf(path + len, MKTREE_PATH_MAX - len, "/d%d", i);
+            if (len + n >= MKTREE_PATH_MAX - 16) {
+                fprintf(stderr, "mktree: path too long\n");
+                exit(1);
+            }
+            make_dir(path, len + n, level + 1);
+        }
+    path[len] = '\0';
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mktree [-d depth] [-f fanout] [-n files] "
+            "[-b bytes] [-l link%%] [-p sparse%%] [-s seed] dir\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char path[MKTREE_PATH_MAX];
+    int c;
+
+    while ((c = getopt(argc, argv, "d:f:n:b:l:p:s:")) != -1) {
+        switch (c) {
+            case 'd':
+                depth = atoi(optarg);
+                break;
+            case 'f':
+                fanout = atoi(optarg);
+                break;
+            case 'n':
+                n_files = atoi(optarg);
+                break;
+            case 'b':
+                file_length = strtoull(optarg, 0, 10);
+                break;
+            case 'l':
+                link_percent = atoi(optarg);
+                break;
+            case 'p':
+                sparse_percent = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, 0, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc - 1 || depth < 0 || fanout < 0 || n_files < 0 ||
+        strlen(argv[optind]) >= MKTREE_PATH_MAX - 16)
+        usage();
+
+    contents = calloc(1, file_length + 1);
+    if (!contents) {
+        perror("calloc");
+        exit(1);
+    }
+    memset(contents, 'x', file_length);
+    strcpy(path, argv[optind]);
+    make_dir(path, strlen(path), 0);
+
+    printf("%" PRIu64 " directories, %" PRIu64 " files, %" PRIu64
+           " sparse, %" PRIu64 " hard links\n",
+           n_dirs_made, n_files_made, n_sparse_made, n_links_made);
+    return 0;
+}
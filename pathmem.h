@@ -44,7 +44,10 @@ static inline int path_get(char *path, int npath, FILE *f, int zeroflag) {
 
 static inline char *path_alloc() {
     if (!path_buffer || n_path_buffer + DU_BUFFER_LENGTH > MAX_PATH_BUFFER) {
-        path_buffer = malloc(MAX_PATH_BUFFER);
+        /* The tail of the old buffer is never used. */
+        if (path_buffer)
+            mem_slack(MEM_PATHS, MAX_PATH_BUFFER - n_path_buffer);
+        path_buffer = mem_malloc(MEM_PATHS, MAX_PATH_BUFFER);
         if (!path_buffer) {
             perror("malloc");
             exit(1);
@@ -56,8 +59,23 @@ static inline char *path_alloc() {
     return result;
 }
 
+/*
+ * Copy an in-memory line of len characters into a fresh
+ * slot, giving back the unused portion of the slot as
+ * path_get() does. Returns 0 if the line cannot fit.
+ */
+static inline char *path_copy(const char *line, int len) {
+    if (len + 1 > DU_BUFFER_LENGTH)
+        return 0;
+    char *path = path_alloc();
+    memcpy(path, line, len);
+    path[len] = '\0';
+    n_path_buffer -= DU_BUFFER_LENGTH - (len + 1);
+    return path;
+}
+
 /* Don't leak spare portion of last block */
 static inline void path_cleanup() {
     if (path_buffer)
-        path_buffer = realloc(path_buffer, n_path_buffer);
+        path_buffer = mem_realloc(MEM_PATHS, path_buffer, n_path_buffer);
 }
@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * What-if deletion plan. Marking an entry moves it out of
+ * its parent's children, to just past the end of them, and
+ * takes its size off every ancestor; each ancestor is then
+ * moved to its new place among its siblings by binary
+ * search. A toggle is O(depth log fanout) comparisons, and
+ * every view of the tree simply no longer sees the entry.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "duvis.h"
+#include "mem.h"
+
+static struct entry **parents = 0;
+static unsigned char *marked = 0;
+static int chains = 0;
+
+/* Marked entries, in the order they were marked. */
+static struct entry **marks = 0;
+static int max_marks = 0;
+int n_marks = 0;
+
+/* Size taken off the root. */
+uint64_t plan_freed = 0;
+
+/* Index of child c among the first n children of p. */
+static uint32_t find_child(struct entry *p, uint32_t n, struct entry *c) {
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (p->children[mid] == c)
+            return mid;
+        if (compare_subtrees(&p->children[mid], &c) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    fprintf(stderr, "plan: children out of order\n");
+    exit(1);
+}
+
+/* Move the child at index i of p to its sorted place. */
+static void resort_child(struct entry *p, uint32_t i) {
+    struct entry **ch = p->children;
+    struct entry *c = ch[i];
+    uint32_t lo, hi;
+
+    if (i > 0 && compare_subtrees(&ch[i - 1], &c) > 0) {
+        lo = 0;
+        hi = i;
+    } else {
+        lo = i + 1;
+        hi = p->n_children;
+    }
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (compare_subtrees(&ch[mid], &c) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < i) {
+        memmove(&ch[lo + 1], &ch[lo], (i - lo) * sizeof(ch[0]));
+        ch[lo] = c;
+    } else if (lo > i + 1) {
+        memmove(&ch[i], &ch[i + 1], (lo - i - 1) * sizeof(ch[0]));
+        ch[lo - 1] = c;
+    }
+}
+
+/*
+ * Add delta to the size of p and each of its ancestors,
+ * keeping every sibling list in order on the way up.
+ */
+static void update_ancestors(struct entry *p, int64_t delta) {
+    while (p) {
+        struct entry *gp = parents[p - entries];
+        uint32_t i = gp ? find_child(gp, gp->n_children, p) : 0;
+        p->size += delta;
+        if (chains)
+            p->n_chain = p->n_children == 1 ?
+                p->children[0]->n_chain + 1 : 0;
+        if (gp)
+            resort_child(gp, i);
+        p = gp;
+    }
+    plan_freed -= delta;
+}
+
+/*
+ * Record the parent of every entry, so marks can walk up.
+ * With chains set, collapse_chains() has been run and is
+ * kept up to date.
+ */
+void plan_init(int collapsed) {
+    parents = mem_calloc(MEM_CHILDREN, n_entries, sizeof(parents[0]));
+    marked = mem_calloc(MEM_CHILDREN, n_entries, 1);
+    if (!parents || !marked) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < n_entries; i++)
+        for (uint32_t j = 0; j < entries[i].n_children; j++)
+            parents[entries[i].children[j] - entries] = &entries[i];
+    chains = collapsed;
+}
+
+static void mark(struct entry *e) {
+    struct entry *p = parents[e - entries];
+    uint32_t i = find_child(p, p->n_children, e);
+
+    memmove(&p->children[i], &p->children[i + 1],
+            (p->n_children - i - 1) * sizeof(p->children[0]));
+    p->n_children--;
+    p->children[p->n_children] = e;
+    marked[e - entries] = 1;
+
+    if (n_marks >= max_marks) {
+        max_marks = max_marks ? 2 * max_marks : 64;
+        marks = mem_realloc(MEM_CHILDREN, marks, max_marks * sizeof(marks[0]));
+        if (!marks) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    marks[n_marks++] = e;
+    update_ancestors(p, -(int64_t) e->size);
+}
+
+static void unmark(struct entry *e) {
+    struct entry *p = parents[e - entries];
+    uint32_t j = p->n_children;
+
+    /* Marked children wait just past the end. */
+    while (p->children[j] != e)
+        j++;
+    p->children[j] = p->children[p->n_children];
+    p->children[p->n_children] = e;
+    p->n_children++;
+    resort_child(p, p->n_children - 1);
+    marked[e - entries] = 0;
+
+    for (int k = 0; k < n_marks; k++)
+        if (marks[k] == e) {
+            memmove(&marks[k], &marks[k + 1],
+                    (n_marks - k - 1) * sizeof(marks[0]));
+            n_marks--;
+            break;
+        }
+    update_ancestors(p, e->size);
+}
+
+/*
+ * Mark e for deletion, or unmark it. The root, and entries
+ * inside a marked subtree, are left alone. Returns whether
+ * e is now marked.
+ */
+int plan_toggle(struct entry *e) {
+    if (e == root_entry)
+        return 0;
+    for (struct entry *p = parents[e - entries]; p; p = parents[p - entries])
+        if (marked[p - entries])
+            return marked[e - entries];
+    if (marked[e - entries])
+        unmark(e);
+    else
+        mark(e);
+    return marked[e - entries];
+}
+
+/* Unmark the entry marked last, if any. */
+void plan_undo(void) {
+    if (n_marks > 0)
+        unmark(marks[n_marks - 1]);
+}
+
+/* The entry named path among the unmarked ones, or 0. */
+static struct entry *find_path(const char *path) {
+    char buf[DU_PATH_MAX + 1];
+    struct entry *e = root_entry;
+
+    while (1) {
+        if (!entry_path(e, buf, sizeof(buf)))
+            return 0;
+        size_t n = strlen(buf);
+        if (strncmp(path, buf, n) != 0 || (path[n] != '\0' && path[n] != '/'))
+            return 0;
+        if (path[n] == '\0')
+            return e;
+
+        struct entry *next = 0;
+        for (uint32_t i = 0; i < e->n_children && !next; i++) {
+            struct entry *c = e->children[i];
+            const char *name = c->components[c->n_components - 1];
+            size_t k = strlen(name);
+            if (strncmp(path + n + 1, name, k) == 0 &&
+                (path[n + 1 + k] == '\0' || path[n + 1 + k] == '/'))
+                next = c;
+        }
+        if (!next)
+            return 0;
+        e = next;
+    }
+}
+
+/* Mark each path listed in file, one per line. */
+void plan_read(const char *file) {
+    FILE *f = fopen(file, "r");
+    char *line = 0;
+    size_t max_line = 0;
+    ssize_t n;
+
+    if (!f) {
+        if (errno == ENOENT)
+            return;
+        perror(file);
+        exit(1);
+    }
+    while ((n = getline(&line, &max_line, f)) != -1) {
+        if (n > 0 && line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+        struct entry *e = find_path(line);
+        if (!e || e == root_entry)
+            fprintf(stderr, "%s: %s: not in tree\n", file, line);
+        else
+            mark(e);
+    }
+    free(line);
+    fclose(f);
+}
+
+/* Write the path of each outermost mark to file. */
+void plan_write(const char *file) {
+    FILE *f = fopen(file, "w");
+    char path[DU_PATH_MAX + 1];
+
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    for (int k = 0; k < n_marks; k++) {
+        struct entry *p = parents[marks[k] - entries];
+        while (p && !marked[p - entries])
+            p = parents[p - entries];
+        if (!p && entry_path(marks[k], path, sizeof(path)))
+            fprintf(f, "%s\n", path);
+    }
+    if (fclose(f) == EOF) {
+        perror(file);
+        exit(1);
+    }
+}
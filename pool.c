@@ -0,0 +1,319 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Work-stealing task runtime. Each thread owns a deque: it
+ * pushes and pops its own forks at the bottom, and idle
+ * threads steal the oldest (largest) work from the top of
+ * someone else's. The main thread is thread 0 and works
+ * whenever it joins.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "pool.h"
+
+/* Forks past this many outstanding per thread just run inline. */
+#define DEQUE_LENGTH 4096
+
+/* Runs of at most this many elements are qsort()ed directly. */
+#define SORT_GRAIN (16 * 1024)
+
+struct deque {
+    pthread_mutex_t lock;
+    unsigned top;             // Thieves take from here
+    unsigned bottom;          // Owner pushes and pops here
+    struct task *tasks[DEQUE_LENGTH];
+};
+
+int pool_threads = 1;
+
+static struct deque *deques;
+static __thread int worker_id = -1;
+
+/* Sleeping threads wait here for n_queued to go positive. */
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static int n_queued = 0;
+static int n_sleeping = 0;
+
+static void run(struct task *t) {
+    t->fn(t->arg);
+    __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+}
+
+static struct task *pop(struct deque *d) {
+    struct task *t = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top) {
+        t = d->tasks[--d->bottom % DEQUE_LENGTH];
+        __atomic_sub_fetch(&n_queued, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+static struct task *steal_from(struct deque *d) {
+    struct task *t = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top) {
+        t = d->tasks[d->top++ % DEQUE_LENGTH];
+        __atomic_sub_fetch(&n_queued, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+/* Try every other thread once, starting from a neighbor. */
+static struct task *steal(void) {
+    for (int i = 1; i < pool_threads; i++) {
+        int victim = (worker_id + i) % pool_threads;
+        struct deque *d = &deques[victim];
+        if (__atomic_load_n(&d->bottom, __ATOMIC_RELAXED) ==
+            __atomic_load_n(&d->top, __ATOMIC_RELAXED))
+            continue;
+        struct task *t = steal_from(d);
+        if (t)
+            return t;
+    }
+    return 0;
+}
+
+static void *worker(void *arg) {
+    worker_id = (intptr_t) arg;
+
+    while (1) {
+        struct task *t = pop(&deques[worker_id]);
+        if (!t)
+            t = steal();
+        if (t) {
+            run(t);
+            continue;
+        }
+
+        /*
+         * Announce sleeping before looking at n_queued, and
+         * pool_fork() does the reverse, so a new task always
+         * either is seen here or wakes us.
+         */
+        pthread_mutex_lock(&idle_lock);
+        __atomic_add_fetch(&n_sleeping, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&n_queued, __ATOMIC_SEQ_CST) == 0)
+            pthread_cond_wait(&idle_cond, &idle_lock);
+        __atomic_sub_fetch(&n_sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    return 0;
+}
+
+void pool_init(int n_threads) {
+    if (n_threads <= 0) {
+        char *s = getenv("DUVIS_THREADS");
+        if (s)
+            n_threads = atoi(s);
+    }
+    if (n_threads <= 0)
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads <= 0)
+        n_threads = 1;
+    if (n_threads > POOL_MAX_THREADS)
+        n_threads = POOL_MAX_THREADS;
+    pool_threads = n_threads;
+
+    deques = mem_calloc(MEM_POOL, pool_threads, sizeof(deques[0]));
+    if (!deques) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < pool_threads; i++)
+        pthread_mutex_init(&deques[i].lock, 0);
+    worker_id = 0;
+
+    for (intptr_t i = 1; i < pool_threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, worker, (void *) i)) {
+            perror("pthread_create");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+}
+
+void pool_fork(struct task *t, void (*fn)(void *arg), void *arg) {
+    t->fn = fn;
+    t->arg = arg;
+    t->done = 0;
+
+    /* Single-threaded, or not a pool thread: run it now. */
+    if (pool_threads == 1 || worker_id < 0) {
+        run(t);
+        return;
+    }
+
+    struct deque *d = &deques[worker_id];
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom - d->top >= DEQUE_LENGTH) {
+        pthread_mutex_unlock(&d->lock);
+        run(t);
+        return;
+    }
+    d->tasks[d->bottom++ % DEQUE_LENGTH] = t;
+    __atomic_add_fetch(&n_queued, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&d->lock);
+
+    if (__atomic_load_n(&n_sleeping, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+void pool_join(struct task *t) {
+    while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+        /* Unless t was stolen, it is at the bottom of our deque. */
+        struct task *u = pop(&deques[worker_id]);
+        if (!u)
+            u = steal();
+        if (u)
+            run(u);
+        else
+            sched_yield();
+    }
+}
+
+struct range {
+    void (*fn)(size_t start, size_t end, void *arg);
+    void *arg;
+    size_t start, end, grain;
+};
+
+static void range_task(void *arg);
+
+static void split_range(struct range *r) {
+    if (r->end - r->start <= r->grain) {
+        r->fn(r->start, r->end, r->arg);
+        return;
+    }
+
+    size_t mid = r->start + (r->end - r->start) / 2;
+    struct range right = *r;
+    struct range left = *r;
+    struct task t;
+
+    right.start = mid;
+    left.end = mid;
+    pool_fork(&t, range_task, &right);
+    split_range(&left);
+    pool_join(&t);
+}
+
+static void range_task(void *arg) {
+    split_range(arg);
+}
+
+void pool_for(size_t start, size_t end, size_t grain,
+              void (*fn)(size_t start, size_t end, void *arg),
+              void *arg) {
+    if (start >= end)
+        return;
+    if (pool_threads == 1 || worker_id < 0) {
+        fn(start, end, arg);
+        return;
+    }
+
+    /* Several pieces per thread, so stealing can even out the load. */
+    if (grain == 0)
+        grain = (end - start) / (8 * pool_threads);
+    if (grain == 0)
+        grain = 1;
+
+    struct range r = {fn, arg, start, end, grain};
+    split_range(&r);
+}
+
+struct sort {
+    char *base;
+    char *tmp;
+    size_t n, size;
+    int (*compare)(const void *, const void *);
+};
+
+static void sort_task(void *arg);
+
+/* Sort s->n elements at s->base, using s->tmp as scratch. */
+static void merge_sort(struct sort *s) {
+    if (s->n <= SORT_GRAIN) {
+        qsort(s->base, s->n, s->size, s->compare);
+        return;
+    }
+
+    size_t n_left = s->n / 2;
+    struct sort left = *s, right = *s;
+    struct task t;
+
+    left.n = n_left;
+    right.base += n_left * s->size;
+    right.tmp += n_left * s->size;
+    right.n -= n_left;
+    pool_fork(&t, sort_task, &right);
+    merge_sort(&left);
+    pool_join(&t);
+
+    /* Merge the halves into the scratch space and copy back. */
+    char *a = left.base, *a_end = right.base;
+    char *b = right.base, *b_end = s->base + s->n * s->size;
+    char *out = s->tmp;
+
+    while (a < a_end && b < b_end) {
+        if (s->compare(b, a) < 0) {
+            memcpy(out, b, s->size);
+            b += s->size;
+        } else {
+            memcpy(out, a, s->size);
+            a += s->size;
+        }
+        out += s->size;
+    }
+    memcpy(out, a, a_end - a);
+    out += a_end - a;
+    memcpy(out, b, b_end - b);
+    memcpy(s->base, s->tmp, s->n * s->size);
+}
+
+static void sort_task(void *arg) {
+    merge_sort(arg);
+}
+
+void pool_sort(void *base, size_t n, size_t size,
+               int (*compare)(const void *, const void *)) {
+    if (pool_threads == 1 || worker_id < 0 || n <= SORT_GRAIN) {
+        qsort(base, n, size, compare);
+        return;
+    }
+
+    struct sort s = {base, mem_malloc(MEM_SORT, n * size), n, size, compare};
+
+    if (!s.tmp) {
+        perror("malloc");
+        exit(1);
+    }
+    merge_sort(&s);
+    mem_free(MEM_SORT, s.tmp);
+}
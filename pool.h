@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Shared work-stealing task runtime. Every stage forks its
+ * work onto the same pool of threads; with one thread all
+ * work runs inline in program order, so results are
+ * reproducible.
+ */
+
+/* Most threads the pool will run. */
+#define POOL_MAX_THREADS 256
+
+/* A forked task. Lives on the stack of the forking frame. */
+struct task {
+    void (*fn)(void *arg);
+    void *arg;
+    int done;
+};
+
+/* Number of threads in the pool, including the main thread. */
+extern int pool_threads;
+
+/*
+ * Start the pool. A count of 0 means $DUVIS_THREADS if
+ * set, else the number of online processors.
+ */
+extern void pool_init(int n_threads);
+
+/* Make fn(arg) available to other threads. */
+extern void pool_fork(struct task *t, void (*fn)(void *arg), void *arg);
+
+/* Wait for a forked task, running other work meanwhile. */
+extern void pool_join(struct task *t);
+
+/*
+ * Call fn on subranges of [start, end) of at most grain
+ * elements, in parallel. A grain of 0 picks one.
+ */
+extern void pool_for(size_t start, size_t end, size_t grain,
+                     void (*fn)(size_t start, size_t end, void *arg),
+                     void *arg);
+
+/* qsort() replacement: parallel merge sort over qsort()ed runs. */
+extern void pool_sort(void *base, size_t n, size_t size,
+                      int (*compare)(const void *, const void *));
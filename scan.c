@@ -0,0 +1,1036 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Built-in scanner: the same totals as du, from a parallel
+ * walk on the thread pool. Every directory is a forked task
+ * that lists itself, stats its files, forks its
+ * subdirectories and adds up their totals once they join.
+ *
+ * With a journal, each directory is appended to it as its
+ * subtree completes: its rolled-up size in 512-byte blocks
+ * (or names, counting inodes), the number of its
+ * subdirectories, its mtime and its path. A header line
+ * names what is counted and the root, and a resume checks
+ * it. The journal is synced at most every SCAN_CHECKPOINT
+ * seconds, so an interrupted scan loses little. The pending
+ * work is every directory without a record, so resuming
+ * walks down from the root again, listing only directories
+ * that did not complete and taking each completed subtree
+ * from the journal whole. A completed scan rewrites the
+ * journal to hold just the final tree. Hard links are only
+ * counted once within a run, so a file linked from both a
+ * reused subtree and a rescanned one counts twice.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "duvis.h"
+#include "hash.h"
+#include "mem.h"
+#include "pool.h"
+
+#define SCAN_SEED 0x7363616e00000001ULL
+#define SCAN_CHECKPOINT 10
+#define SCAN_REFRESH 1
+#define SCAN_DENTS_LENGTH (64 * 1024)
+
+struct dir {
+    struct dir *parent;
+    char *name;               // The whole path at the root
+    struct dir *children;
+    uint32_t n_children;
+    uint32_t n_sub;           // Children that were still there
+    uint64_t blocks;          // Rolled up once the children join
+    struct timespec mtime;
+    int64_t record;           // Journal record reused, or -1
+    int gone;
+    struct task task;
+    uint64_t prio;            // Best-first: expected blocks
+    uint32_t pending;         // Best-first: unfinished children + 1
+    int listed;               // Best-first: children may be walked
+};
+
+/* A completed directory read back from the journal. */
+struct record {
+    char *path;
+    uint64_t blocks;
+    struct timespec mtime;
+    uint32_t n_sub;
+    uint32_t n_seen;          // Children with records of their own
+    uint32_t seq;             // Later records replace earlier ones
+    unsigned char ok;         // Whole subtree usable
+};
+
+static char *journal_text = 0;        // The records point into it
+static off_t journal_length = -1;     // Complete lines; -1 if no file
+static struct record *records = 0;
+static int64_t n_records = 0;
+static uint32_t *record_slots = 0;    // Record index + 1, or 0 if empty
+static uint64_t record_mask = 0;
+
+static FILE *journal = 0;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t last_sync;
+
+/* Multiply-linked files already counted. */
+struct link {
+    dev_t dev;
+    ino_t ino;
+};
+
+static struct link *links = 0;
+static uint64_t n_links = 0, links_mask = 0;
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t n_scanned = 0, n_reused = 0;
+
+/* Count names instead of blocks. */
+static int count_inodes = 0;
+
+static void *scan_alloc(void *p, size_t size) {
+    p = mem_realloc(MEM_SCAN, p, size);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+/* A total as du shows it. */
+static uint64_t shown(uint64_t blocks) {
+    return count_inodes ? blocks : (blocks + 1) / 2;
+}
+
+static time_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* The path of d, which must fit in DU_PATH_MAX. */
+static size_t dir_path(struct dir *d, char *buf) {
+    if (!d->parent) {
+        size_t n = strlen(d->name);
+        if (n >= DU_PATH_MAX) {
+            fprintf(stderr, "%s: path too long\n", d->name);
+            exit(1);
+        }
+        memcpy(buf, d->name, n + 1);
+        return n;
+    }
+
+    size_t n = dir_path(d->parent, buf);
+    size_t len = strlen(d->name);
+    int slash = n > 0 && buf[n - 1] == '/';
+    if (n + len + 2 > DU_PATH_MAX) {
+        fprintf(stderr, "%s: path too long\n", buf);
+        exit(1);
+    }
+    if (!slash)
+        buf[n++] = '/';
+    memcpy(buf + n, d->name, len + 1);
+    return n + len;
+}
+
+/* Returns 1 the first time a file is seen. */
+static int first_link(dev_t dev, ino_t ino) {
+    pthread_mutex_lock(&links_lock);
+    if (2 * (n_links + 1) > links_mask + 1 || !links) {
+        uint64_t n_slots = links ? 2 * (links_mask + 1) : 1024;
+        struct link *old = links;
+        links = mem_calloc(MEM_SCAN, n_slots, sizeof(links[0]));
+        if (!links) {
+            perror("calloc");
+            exit(1);
+        }
+        for (uint64_t i = 0; old && i <= links_mask; i++) {
+            if (old[i].ino == 0)
+                continue;
+            uint64_t j = hash_mix(old[i].dev ^ hash_mix(old[i].ino)) &
+                         (n_slots - 1);
+            while (links[j].ino)
+                j = (j + 1) & (n_slots - 1);
+            links[j] = old[i];
+        }
+        mem_free(MEM_SCAN, old);
+        links_mask = n_slots - 1;
+    }
+
+    uint64_t i = hash_mix(dev ^ hash_mix(ino)) & links_mask;
+    int first = 1;
+    while (links[i].ino) {
+        if (links[i].dev == dev && links[i].ino == ino) {
+            first = 0;
+            break;
+        }
+        i = (i + 1) & links_mask;
+    }
+    if (first) {
+        links[i].dev = dev;
+        links[i].ino = ino;
+        n_links++;
+    }
+    pthread_mutex_unlock(&links_lock);
+    return first;
+}
+
+/* Record a completed directory, syncing now and then. */
+static void journal_done(struct dir *d, const char *path) {
+    if (!journal)
+        return;
+    pthread_mutex_lock(&journal_lock);
+    fprintf(journal, "%" PRIu64 "\t%" PRIu32 "\t%lld.%09ld\t%s\n",
+            d->blocks, d->n_sub, (long long) d->mtime.tv_sec,
+            d->mtime.tv_nsec, path);
+    if (now() - last_sync >= SCAN_CHECKPOINT) {
+        if (fflush(journal) == EOF || fsync(fileno(journal)) == -1) {
+            perror("journal");
+            exit(1);
+        }
+        last_sync = now();
+    }
+    pthread_mutex_unlock(&journal_lock);
+}
+
+static uint32_t *record_slot(const char *path, size_t len) {
+    uint64_t i = hash64(path, len, SCAN_SEED) & record_mask;
+
+    while (record_slots[i]) {
+        const char *p = records[record_slots[i] - 1].path;
+        if (!strncmp(p, path, len) && p[len] == '\0')
+            break;
+        i = (i + 1) & record_mask;
+    }
+    return &record_slots[i];
+}
+
+/* The record for path if its whole subtree is usable, else -1. */
+static int64_t usable(const char *path, size_t len) {
+    if (n_records == 0)
+        return -1;
+    uint32_t slot = *record_slot(path, len);
+    if (!slot || !records[slot - 1].ok)
+        return -1;
+    return slot - 1;
+}
+
+static struct dir *add_child(struct dir *d, uint32_t *max_children,
+                             const char *name) {
+    if (d->n_children >= *max_children) {
+        *max_children = *max_children ? 2 * *max_children : 16;
+        d->children = scan_alloc(d->children,
+                                 *max_children * sizeof(d->children[0]));
+    }
+    struct dir *c = &d->children[d->n_children++];
+    memset(c, 0, sizeof(*c));
+    c->name = scan_alloc(0, strlen(name) + 1);
+    strcpy(c->name, name);
+    return c;
+}
+
+/*
+ * --count-inodes: list with getdents64() alone, counting
+ * one for each name and one for d itself into *own. Only
+ * subdirectories, and names whose type the file system does
+ * not give, are ever stat()ed, and then only with weigh.
+ */
+static int list_names(struct dir *d, int fd, const char *path,
+                      uint64_t *own, int weigh) {
+    static __thread char *dents = 0;
+    uint32_t max_children = 0;
+    struct stat st;
+    ssize_t n;
+
+    if (!dents)
+        dents = scan_alloc(0, SCAN_DENTS_LENGTH);
+    *own = 1;
+    while ((n = getdents64(fd, dents, SCAN_DENTS_LENGTH)) > 0) {
+        for (ssize_t i = 0; i < n; ) {
+            struct dirent64 *de = (struct dirent64 *) (dents + i);
+            i += de->d_reclen;
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+                continue;
+            int type = de->d_type;
+            if (type == DT_UNKNOWN || (type == DT_DIR && weigh)) {
+                if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                    fprintf(stderr, "%s/%s: %s\n", path, de->d_name,
+                            strerror(errno));
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+            }
+            if (type != DT_DIR) {
+                (*own)++;
+                continue;
+            }
+            struct dir *c = add_child(d, &max_children, de->d_name);
+            if (weigh)
+                c->prio = st.st_nlink + st.st_size / 32;
+        }
+    }
+    if (n == -1)
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(fd);
+
+    for (uint32_t i = 0; i < d->n_children; i++)
+        d->children[i].parent = d;
+    return 1;
+}
+
+/*
+ * List the directory at path into d's children, counting
+ * its own and its files' blocks into *own. With weigh, also
+ * stat each subdirectory and set its prio to a weight for
+ * how much it might hold: its link count, which is two more
+ * than its subdirectories on most file systems, plus its
+ * length, which grows with its entries. Returns 1 if d was
+ * listed, 0 if it could only be counted, and -1 if it has
+ * gone.
+ */
+static int list_dir(struct dir *d, const char *path, uint64_t *own,
+                    int weigh) {
+    struct stat st;
+    struct dirent *de;
+    uint32_t max_children = 0;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        /* du still counts a directory it cannot read. */
+        if (lstat(path, &st) == -1)
+            return -1;
+        *own = count_inodes ? 1 : st.st_blocks;
+        d->mtime = st.st_mtim;
+        return 0;
+    }
+    *own = st.st_blocks;
+    d->mtime = st.st_mtim;
+    if (count_inodes)
+        return list_names(d, fd, path, own, weigh);
+
+    DIR *dp = fdopendir(fd);
+    if (!dp) {
+        perror(path);
+        exit(1);
+    }
+    while ((de = readdir(dp))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        if (de->d_type != DT_DIR || weigh) {
+            if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                fprintf(stderr, "%s/%s: %s\n", path, de->d_name,
+                        strerror(errno));
+                continue;
+            }
+            if (!S_ISDIR(st.st_mode)) {
+                /* du counts each multiply-linked file only once. */
+                if (st.st_nlink == 1 || first_link(st.st_dev, st.st_ino))
+                    *own += st.st_blocks;
+                continue;
+            }
+        }
+
+        struct dir *c = add_child(d, &max_children, de->d_name);
+        if (weigh)
+            c->prio = st.st_nlink + st.st_size / 32;
+    }
+    closedir(dp);
+
+    for (uint32_t i = 0; i < d->n_children; i++)
+        d->children[i].parent = d;
+    return 1;
+}
+
+/* Set path, the path of d of length n, to that of child c. */
+static void child_path(char *path, size_t n, struct dir *c) {
+    snprintf(path + n, DU_PATH_MAX - n, "%s%s",
+             n > 0 && path[n - 1] == '/' ? "" : "/", c->name);
+}
+
+static void scan_dir(void *arg) {
+    struct dir *d = arg;
+    /* Joins run other tasks, so frames nest deeper than the tree. */
+    char *path = scan_alloc(0, DU_PATH_MAX);
+    size_t n = dir_path(d, path);
+    int listed = list_dir(d, path, &d->blocks, 0);
+
+    if (listed < 0)
+        d->gone = 1;
+    if (listed <= 0) {
+        if (listed == 0)
+            journal_done(d, path);
+        mem_free(MEM_SCAN, path);
+        return;
+    }
+
+    for (uint32_t i = 0; i < d->n_children; i++) {
+        struct dir *c = &d->children[i];
+        child_path(path, n, c);
+        c->record = usable(path, strlen(path));
+        if (c->record >= 0)
+            c->blocks = records[c->record].blocks;
+        else
+            pool_fork(&c->task, scan_dir, c);
+    }
+    path[n] = '\0';
+
+    for (uint32_t i = 0; i < d->n_children; i++) {
+        struct dir *c = &d->children[i];
+        if (c->record < 0)
+            pool_join(&c->task);
+        if (!c->gone) {
+            d->blocks += c->blocks;
+            d->n_sub++;
+        }
+    }
+    journal_done(d, path);
+    mem_free(MEM_SCAN, path);
+}
+
+/* Journal order: a path, then everything below it, then the rest. */
+static int compare_paths(const char *p1, const char *p2) {
+    for (;; p1++, p2++) {
+        int c1 = *p1 == '/' ? 1 : *p1 ? (unsigned char) *p1 + 1 : 0;
+        int c2 = *p2 == '/' ? 1 : *p2 ? (unsigned char) *p2 + 1 : 0;
+        if (c1 != c2)
+            return c1 - c2;
+        if (c1 == 0)
+            return 0;
+    }
+}
+
+static int compare_records(const void *p1, const void *p2) {
+    const struct record *r1 = p1;
+    const struct record *r2 = p2;
+    int q = compare_paths(r1->path, r2->path);
+
+    if (q)
+        return q;
+    return r1->seq < r2->seq ? -1 : 1;
+}
+
+/* Is path within the subtree at top, of length len? */
+static int below(const char *path, const char *top, size_t len) {
+    return !strncmp(path, top, len) &&
+           (path[len] == '/' || (len > 0 && top[len - 1] == '/' && path[len]));
+}
+
+/* The record for the parent of record i, or -1. */
+static int64_t parent_record(int64_t i) {
+    const char *path = records[i].path;
+    const char *slash = strrchr(path, '/');
+
+    if (!slash || slash[1] == '\0')
+        return -1;
+    size_t len = slash - path;
+    uint32_t slot = *record_slot(path, len);
+    if (!slot)
+        slot = *record_slot(path, len + 1);
+    return (int64_t) slot - 1;
+}
+
+static void recheck_range(size_t start, size_t end, void *arg) {
+    struct stat st;
+
+    for (size_t i = start; i < end; i++)
+        records[i].ok = lstat(records[i].path, &st) == 0 &&
+                        S_ISDIR(st.st_mode) &&
+                        st.st_mtim.tv_sec == records[i].mtime.tv_sec &&
+                        st.st_mtim.tv_nsec == records[i].mtime.tv_nsec;
+}
+
+/*
+ * Read the records of an earlier scan. A record is usable
+ * if every directory below it also has one; with recheck,
+ * their mtimes must also be unchanged. A partial last line
+ * from an interrupted write is ignored.
+ */
+/* First line of a journal: what it counts, and the root. */
+static void journal_header(FILE *f, const char *dir) {
+    fprintf(f, "#journal\t%s\t%s\n", count_inodes ? "inodes" : "blocks",
+            dir);
+}
+
+/* Check the header line of a journal against this scan. */
+static void check_header(const char *file, const char *line,
+                         const char *dir) {
+    const char *mode = count_inodes ? "inodes" : "blocks";
+    size_t n = strlen(mode);
+
+    if (strncmp(line, "#journal\t", 9)) {
+        fprintf(stderr, "%s: not a scan journal\n", file);
+        exit(1);
+    }
+    line += 9;
+    if (strncmp(line, mode, n) || line[n] != '\t' ||
+        strcmp(line + n + 1, dir)) {
+        size_t k = strcspn(line, "\t");
+        fprintf(stderr, "%s: journal counts %.*s under %s; not resuming\n",
+                file, (int) k, line, line + k + (line[k] == '\t'));
+        exit(1);
+    }
+}
+
+static void load_journal(const char *file, int recheck, const char *dir) {
+    FILE *f = fopen(file, "r");
+    if (!f && errno == ENOENT)
+        return;
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    char *text = 0;
+    size_t n_text = 0, max_text = 0, n;
+    do {
+        if (n_text + 65536 + 1 > max_text) {
+            max_text = 2 * (n_text + 65536 + 1);
+            text = scan_alloc(text, max_text);
+        }
+        n = fread(text + n_text, 1, 65536, f);
+        n_text += n;
+    } while (n > 0);
+    if (ferror(f)) {
+        perror(file);
+        exit(1);
+    }
+    fclose(f);
+    /* A line cut off by an interruption is dropped. */
+    while (n_text > 0 && text[n_text - 1] != '\n')
+        n_text--;
+    journal_text = text;
+    journal_length = n_text;
+
+    int64_t max_records = 0;
+    for (char *line = text, *end; line < text + n_text; line = end + 1) {
+        end = memchr(line, '\n', text + n_text - line);
+        *end = '\0';
+        if (line == text) {
+            check_header(file, line, dir);
+            continue;
+        }
+
+        struct record r;
+        char *s = line;
+        r.blocks = strtoull(s, &s, 10);
+        int bad = s == line || *s != '\t';
+        if (!bad)
+            r.n_sub = strtoul(s + 1, &s, 10);
+        bad = bad || *s != '\t';
+        if (!bad)
+            r.mtime.tv_sec = strtoll(s + 1, &s, 10);
+        bad = bad || *s != '.';
+        if (!bad)
+            r.mtime.tv_nsec = strtol(s + 1, &s, 10);
+        if (bad || *s != '\t') {
+            fprintf(stderr, "%s line %" PRId64 ": journal format error\n",
+                    file, n_records + 2);
+            exit(1);
+        }
+        r.path = s + 1;
+        r.n_seen = 0;
+        r.seq = n_records;
+        r.ok = 1;
+
+        if (n_records >= max_records) {
+            max_records = max_records ? 2 * max_records : 1024;
+            records = scan_alloc(records, max_records * sizeof(records[0]));
+        }
+        records[n_records++] = r;
+    }
+    if (n_records == 0)
+        return;
+
+    /* Keep only the last record of each path. */
+    pool_sort(records, n_records, sizeof(records[0]), compare_records);
+    int64_t k = 0;
+    for (int64_t i = 0; i < n_records; i++) {
+        if (k > 0 && !compare_paths(records[k - 1].path, records[i].path))
+            k--;
+        records[k++] = records[i];
+    }
+    mem_slack(MEM_SCAN, (n_records - k) * (int64_t) sizeof(records[0]));
+    n_records = k;
+
+    uint64_t n_slots = 1024;
+    while (n_slots < 2 * (uint64_t) n_records)
+        n_slots *= 2;
+    record_slots = mem_calloc(MEM_SCAN, n_slots, sizeof(record_slots[0]));
+    if (!record_slots) {
+        perror("calloc");
+        exit(1);
+    }
+    record_mask = n_slots - 1;
+    for (int64_t i = 0; i < n_records; i++)
+        *record_slot(records[i].path, strlen(records[i].path)) = i + 1;
+
+    if (recheck)
+        pool_for(0, n_records, 0, recheck_range, 0);
+
+    /*
+     * Everything below a record sorts after it, so going
+     * backwards sees a directory's children before it. A
+     * child left from before its parent was scanned again
+     * shows up as one too many.
+     */
+    for (int64_t i = n_records - 1; i >= 0; i--) {
+        struct record *r = &records[i];
+        r->ok = r->ok && r->n_seen == r->n_sub;
+        int64_t p = parent_record(i);
+        if (p >= 0) {
+            records[p].n_seen++;
+            if (!r->ok)
+                records[p].ok = 0;
+        }
+    }
+}
+
+/*
+ * Best-first: instead of forking down the tree, every pool
+ * thread takes the directory expected to be largest from
+ * one shared queue. Each directory's blocks only grow, by
+ * everything found below it so far, which makes them a
+ * lower bound until its subtree completes, when they are
+ * its total.
+ */
+static struct dir **queue = 0;
+static uint32_t n_queue = 0, max_queue = 0, n_active = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t n_listed = 0;
+
+/* Max-heap on prio. */
+static void push_dir(struct dir *d) {
+    if (n_queue >= max_queue) {
+        max_queue = max_queue ? 2 * max_queue : 1024;
+        queue = scan_alloc(queue, max_queue * sizeof(queue[0]));
+    }
+    uint32_t i = n_queue++;
+    while (i > 0 && queue[(i - 1) / 2]->prio < d->prio) {
+        queue[i] = queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue[i] = d;
+}
+
+static struct dir *pop_dir(void) {
+    struct dir *top = queue[0];
+    struct dir *last = queue[--n_queue];
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= n_queue)
+            break;
+        if (c + 1 < n_queue && queue[c + 1]->prio > queue[c]->prio)
+            c++;
+        if (queue[c]->prio <= last->prio)
+            break;
+        queue[i] = queue[c];
+        i = c;
+    }
+    if (n_queue > 0)
+        queue[i] = last;
+    return top;
+}
+
+static void add_found(struct dir *d, uint64_t blocks) {
+    for (; d; d = d->parent)
+        __atomic_add_fetch(&d->blocks, blocks, __ATOMIC_RELAXED);
+}
+
+/* One of d's children, or d itself, is done. */
+static void finish_dir(struct dir *d) {
+    char path[DU_PATH_MAX];
+
+    for (; d && __atomic_sub_fetch(&d->pending, 1, __ATOMIC_ACQ_REL) == 0;
+         d = d->parent) {
+        if (d->gone)
+            continue;
+        for (uint32_t i = 0; i < d->n_children; i++)
+            d->n_sub += !d->children[i].gone;
+        dir_path(d, path);
+        journal_done(d, path);
+    }
+}
+
+static void hot_dir(struct dir *d) {
+    char *path = scan_alloc(0, DU_PATH_MAX);
+    size_t n = dir_path(d, path);
+    uint64_t own = 0, weights = 0;
+    int listed = list_dir(d, path, &own, 1);
+
+    __atomic_store_n(&d->gone, listed < 0, __ATOMIC_RELAXED);
+    add_found(d, own);
+    for (uint32_t i = 0; i < d->n_children; i++)
+        weights += d->children[i].prio;
+
+    /* Pending counts d itself until its children are queued. */
+    uint32_t n_queued = 0;
+    for (uint32_t i = 0; i < d->n_children; i++) {
+        struct dir *c = &d->children[i];
+        child_path(path, n, c);
+        c->record = usable(path, strlen(path));
+        if (c->record >= 0) {
+            c->pending = 0;
+            add_found(c, records[c->record].blocks);
+            continue;
+        }
+        /* A size from an earlier scan beats a share of d's guess. */
+        uint32_t slot = n_records > 0 ? *record_slot(path, strlen(path)) : 0;
+        if (slot)
+            c->prio = records[slot - 1].blocks;
+        else
+            c->prio = (double) d->prio * c->prio / weights;
+        c->pending = 1;
+        n_queued++;
+    }
+    mem_free(MEM_SCAN, path);
+    __atomic_store_n(&d->pending, n_queued + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&d->listed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&n_listed, 1, __ATOMIC_RELAXED);
+
+    if (n_queued > 0) {
+        pthread_mutex_lock(&queue_lock);
+        for (uint32_t i = 0; i < d->n_children; i++)
+            if (d->children[i].record < 0)
+                push_dir(&d->children[i]);
+        pthread_cond_broadcast(&queue_cond);
+        pthread_mutex_unlock(&queue_lock);
+    }
+    finish_dir(d);
+}
+
+static void hot_worker(size_t start, size_t end, void *arg) {
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        while (n_queue == 0 && n_active > 0)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if (n_queue == 0)
+            break;
+        struct dir *d = pop_dir();
+        n_active++;
+        pthread_mutex_unlock(&queue_lock);
+        hot_dir(d);
+        pthread_mutex_lock(&queue_lock);
+        if (--n_active == 0 && n_queue == 0)
+            pthread_cond_broadcast(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/* The largest subtrees found so far, as a min-heap on blocks. */
+struct hot {
+    uint64_t blocks;
+    struct dir *d;            // Or else
+    const char *path;         // a journal record's path
+    int done;
+};
+
+static struct hot *hots = 0;
+static int n_hots = 0, max_hots = 0;
+
+static void consider(uint64_t blocks, struct dir *d, const char *path,
+                     int done) {
+    struct hot h = {blocks, d, path, done};
+    int i;
+
+    if (n_hots == max_hots) {
+        if (blocks <= hots[0].blocks)
+            return;
+        /* Replace the smallest and sift it down. */
+        i = 0;
+        for (;;) {
+            int c = 2 * i + 1;
+            if (c >= n_hots)
+                break;
+            if (c + 1 < n_hots && hots[c + 1].blocks < hots[c].blocks)
+                c++;
+            if (hots[c].blocks >= blocks)
+                break;
+            hots[i] = hots[c];
+            i = c;
+        }
+    } else {
+        for (i = n_hots++; i > 0 && hots[(i - 1) / 2].blocks > blocks;
+             i = (i - 1) / 2)
+            hots[i] = hots[(i - 1) / 2];
+    }
+    hots[i] = h;
+}
+
+static void walk_hot(struct dir *d, char *path) {
+    if (__atomic_load_n(&d->gone, __ATOMIC_RELAXED))
+        return;
+    consider(__atomic_load_n(&d->blocks, __ATOMIC_RELAXED), d, 0,
+             __atomic_load_n(&d->pending, __ATOMIC_ACQUIRE) == 0 &&
+             (d->record >= 0 || __atomic_load_n(&d->listed,
+                                                __ATOMIC_ACQUIRE)));
+    if (d->record >= 0) {
+        size_t n = dir_path(d, path);
+        for (int64_t i = d->record + 1;
+             i < n_records && below(records[i].path, path, n); i++)
+            consider(records[i].blocks, 0, records[i].path, 1);
+        return;
+    }
+    if (!__atomic_load_n(&d->listed, __ATOMIC_ACQUIRE))
+        return;
+    for (uint32_t i = 0; i < d->n_children; i++)
+        walk_hot(&d->children[i], path);
+}
+
+static int compare_hots(const void *p1, const void *p2) {
+    const struct hot *h1 = p1;
+    const struct hot *h2 = p2;
+
+    if (h1->blocks != h2->blocks)
+        return h1->blocks > h2->blocks ? -1 : 1;
+    return 0;
+}
+
+/* Print the largest subtrees; a + marks a lower bound. */
+static void show_hot(struct dir *root, double seconds) {
+    char path[DU_PATH_MAX];
+
+    n_hots = 0;
+    walk_hot(root, path);
+    qsort(hots, n_hots, sizeof(hots[0]), compare_hots);
+
+    pthread_mutex_lock(&queue_lock);
+    uint32_t queued = n_queue;
+    pthread_mutex_unlock(&queue_lock);
+    fprintf(stderr, "hot: %.1fs, %" PRIu64 " listed, %" PRIu32 " queued\n",
+            seconds, __atomic_load_n(&n_listed, __ATOMIC_RELAXED), queued);
+    for (int i = 0; i < n_hots; i++) {
+        struct hot *h = &hots[i];
+        if (h->d)
+            dir_path(h->d, path);
+        fprintf(stderr, "  %12" PRIu64 "%s %s\n", shown(h->blocks),
+                h->done ? " " : "+", h->d ? path : h->path);
+    }
+}
+
+static int hot_finished = 0;
+static pthread_mutex_t hot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hot_cond = PTHREAD_COND_INITIALIZER;
+static struct timespec hot_start;
+
+static double elapsed(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec - hot_start.tv_sec +
+           (ts.tv_nsec - hot_start.tv_nsec) * 1e-9;
+}
+
+static void *hot_reporter(void *arg) {
+    struct timespec next = hot_start;
+
+    pthread_mutex_lock(&hot_lock);
+    for (;;) {
+        next.tv_sec += SCAN_REFRESH;
+        while (!hot_finished &&
+               pthread_cond_timedwait(&hot_cond, &hot_lock, &next) == 0)
+            ;
+        if (hot_finished)
+            break;
+        show_hot(arg, elapsed());
+    }
+    pthread_mutex_unlock(&hot_lock);
+    return 0;
+}
+
+/*
+ * Scan best-first from root, printing the top largest
+ * subtrees to standard error every SCAN_REFRESH seconds
+ * and once more at the end.
+ */
+static void scan_hot(struct dir *root, int top) {
+    pthread_t reporter;
+
+    struct statvfs sv;
+    uint32_t slot = n_records > 0 ? *record_slot(root->name,
+                                                 strlen(root->name)) : 0;
+
+    max_hots = top;
+    hots = scan_alloc(0, top * sizeof(hots[0]));
+    /* Failing an earlier scan, guess what the file system has in use. */
+    if (slot)
+        root->prio = records[slot - 1].blocks;
+    else if (statvfs(root->name, &sv) == 0)
+        root->prio = (uint64_t) (sv.f_blocks - sv.f_bfree) * sv.f_frsize / 512;
+    else
+        root->prio = UINT64_MAX / 2;
+    root->pending = 1;
+    push_dir(root);
+
+    clock_gettime(CLOCK_REALTIME, &hot_start);
+    if (pthread_create(&reporter, 0, hot_reporter, root)) {
+        perror("pthread_create");
+        exit(1);
+    }
+    pool_for(0, pool_threads, 1, hot_worker, 0);
+
+    pthread_mutex_lock(&hot_lock);
+    hot_finished = 1;
+    pthread_cond_signal(&hot_cond);
+    pthread_mutex_unlock(&hot_lock);
+    pthread_join(reporter, 0);
+
+    show_hot(root, elapsed());
+    mem_free(MEM_SCAN, hots);
+    mem_free(MEM_SCAN, queue);
+}
+
+static int line_number = 0;
+
+static void emit(FILE *out, uint64_t blocks, uint32_t n_sub,
+                 struct timespec mtime, const char *path) {
+    char line[DU_PATH_MAX + 32];
+    int n = snprintf(line, sizeof(line), "%" PRIu64 "\t%s",
+                     shown(blocks), path);
+    add_line(line, n, ++line_number);
+    if (out)
+        fprintf(out, "%" PRIu64 "\t%" PRIu32 "\t%lld.%09ld\t%s\n",
+                blocks, n_sub, (long long) mtime.tv_sec, mtime.tv_nsec, path);
+}
+
+/*
+ * Add d's subtree to the entry table in postorder. A reused
+ * subtree is its journal records backwards, which is a
+ * postorder too. Everything goes to out as well, if given.
+ */
+static void emit_dir(FILE *out, struct dir *d, char *path, size_t n) {
+    if (d->gone)
+        return;
+    if (d->record >= 0) {
+        int64_t end = d->record + 1;
+        while (end < n_records && below(records[end].path, path, n))
+            end++;
+        for (int64_t i = end - 1; i >= d->record; i--)
+            emit(out, records[i].blocks, records[i].n_sub,
+                 records[i].mtime, records[i].path);
+        n_reused += end - d->record;
+        return;
+    }
+
+    for (uint32_t i = 0; i < d->n_children; i++) {
+        struct dir *c = &d->children[i];
+        child_path(path, n, c);
+        emit_dir(out, c, path, strlen(path));
+        mem_free(MEM_SCAN, c->name);
+    }
+    path[n] = '\0';
+    mem_free(MEM_SCAN, d->children);
+    emit(out, d->blocks, d->n_sub, d->mtime, path);
+    n_scanned++;
+}
+
+/*
+ * Scan dir into the entry table, in du's postorder, with
+ * sizes in kilobytes. With a journal file, checkpoint into
+ * it; with resume, first take what an earlier scan
+ * finished from it, if there is one. With top, scan
+ * best-first and keep showing the top largest subtrees.
+ * With inodes, the sizes are counts of names instead.
+ */
+void scan_entries(const char *dir, const char *journal_file, int resume,
+                  int recheck, int top, int inodes) {
+    struct dir root;
+    char path[DU_PATH_MAX];
+
+    count_inodes = inodes;
+    if (resume)
+        load_journal(journal_file, recheck, dir);
+    /* New records must not run on from a cut-off last line. */
+    if (journal_length >= 0 && truncate(journal_file, journal_length) == -1) {
+        perror(journal_file);
+        exit(1);
+    }
+    if (journal_file) {
+        journal = fopen(journal_file, resume ? "a" : "w");
+        if (!journal) {
+            perror(journal_file);
+            exit(1);
+        }
+        if (journal_length <= 0) {
+            journal_header(journal, dir);
+            if (fflush(journal) == EOF) {
+                perror(journal_file);
+                exit(1);
+            }
+        }
+        last_sync = now();
+    }
+
+    memset(&root, 0, sizeof(root));
+    root.name = (char *) dir;
+    root.record = usable(dir, strlen(dir));
+    if (root.record >= 0)
+        root.blocks = records[root.record].blocks;
+    else if (top > 0)
+        scan_hot(&root, top);
+    else
+        scan_dir(&root);
+    if (root.gone) {
+        fprintf(stderr, "%s: nothing to scan\n", dir);
+        exit(1);
+    }
+
+    /* The finished tree replaces the journal. */
+    FILE *out = 0;
+    char *tmp = 0;
+    if (journal) {
+        if (fclose(journal) == EOF) {
+            perror(journal_file);
+            exit(1);
+        }
+        journal = 0;
+        tmp = scan_alloc(0, strlen(journal_file) + 5);
+        sprintf(tmp, "%s.new", journal_file);
+        out = fopen(tmp, "w");
+        if (!out) {
+            perror(tmp);
+            exit(1);
+        }
+        journal_header(out, dir);
+    }
+
+    dir_path(&root, path);
+    emit_dir(out, &root, path, strlen(path));
+
+    if (out) {
+        if (fflush(out) == EOF || fsync(fileno(out)) == -1 ||
+            fclose(out) == EOF || rename(tmp, journal_file) == -1) {
+            perror(tmp);
+            exit(1);
+        }
+        mem_free(MEM_SCAN, tmp);
+    }
+    fprintf(stderr, "scan: %" PRIu64 " directories scanned, %" PRIu64
+            " from the journal\n", n_scanned, n_reused);
+
+    mem_free(MEM_SCAN, journal_text);
+    mem_free(MEM_SCAN, records);
+    mem_free(MEM_SCAN, record_slots);
+    mem_free(MEM_SCAN, links);
+}
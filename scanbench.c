@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * Scan benchmark: times duvis reading a directory tree for
+ * each pair of thread count and queue depth (the number of
+ * scans in flight: du processes under --fanout), optionally
+ * with latency.so injecting delays into the file system
+ * calls, and reports entries scanned per second. The scan
+ * and inodes modes time --scan and --count-inodes instead,
+ * which have no queue depth of their own: the threads are
+ * the scans in flight. Make a tree to scan with mktree.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum mode { MODE_FANOUT, MODE_SCAN, MODE_INODES };
+
+static char *mode_names[] = {"fanout", "scan", "inodes"};
+
+#define N_MODES (sizeof(mode_names) / sizeof(mode_names[0]))
+
+static uint64_t n_found = 0;
+
+static int count_entry(const char *path, const struct stat *st, int flag,
+                       struct FTW *ftw) {
+    n_found++;
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Run duvis over dir once, and return how long it took. */
+static double run_scan(char *duvis, char *dir, enum mode mode,
+                       int n_threads, int depth) {
+    char threads[16], fanout[16];
+    char *fanout_args[] =
+        {duvis, "--threads", threads, "--fanout", fanout, dir, 0};
+    char *scan_args[] = {duvis, "--threads", threads, "--scan", dir, 0};
+    char *inodes_args[] =
+        {duvis, "--threads", threads, "--count-inodes", dir, 0};
+    char **args = mode == MODE_SCAN ? scan_args :
+        mode == MODE_INODES ? inodes_args : fanout_args;
+
+    snprintf(threads, sizeof(threads), "%d", n_threads);
+    snprintf(fanout, sizeof(fanout), "%d", depth);
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout) ||
+            !freopen("/dev/null", "w", stderr))
+            _exit(1);
+        execv(duvis, args);
+        _exit(1);
+    }
+    int wstatus;
+    if (waitpid(pid, &wstatus, 0) == -1 ||
+        !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        fprintf(stderr, "scanbench: %s failed\n", duvis);
+        exit(1);
+    }
+    return now() - start;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: scanbench [-m fanout|scan|inodes] "
+            "[-t threads,...] [-q depths,...] [-r repeats] "
+            "[-l latency-us] [-j jitter-us] [-x duvis] [-p shim] dir\n"
+            "  -q applies to the fanout mode only\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    char *thread_list = "1,2,4,8", *depth_list = "1,4,16";
+    char *duvis = "./duvis", *shim = "./latency.so";
+    char *latency = "0", *jitter = "0";
+    enum mode mode = MODE_FANOUT;
+    int repeats = 3;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:t:q:r:l:j:x:p:")) != -1) {
+        switch (c) {
+            case 'm':
+                for (mode = 0; mode < N_MODES; mode++)
+                    if (!strcmp(optarg, mode_names[mode]))
+                        break;
+                if (mode == N_MODES)
+                    usage();
+                break;
+            case 't':
+                thread_list = optarg;
+                break;
+            case 'q':
+                depth_list = optarg;
+                break;
+            case 'r':
+                repeats = atoi(optarg);
+                break;
+            case 'l':
+                latency = optarg;
+                break;
+            case 'j':
+                jitter = optarg;
+                break;
+            case 'x':
+                duvis = optarg;
+                break;
+            case 'p':
+                shim = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc - 1 || repeats < 1)
+        usage();
+    char *dir = argv[optind];
+    /* One pass per thread count; the depth is not used. */
+    if (mode != MODE_FANOUT)
+        depth_list = "1";
+
+    /* Count every name, before the shim is in place. */
+    if (nftw(dir, count_entry, 64, FTW_PHYS) == -1) {
+        perror(dir);
+        exit(1);
+    }
+    if (atol(latency) > 0 || atol(jitter) > 0) {
+        if (access(shim, R_OK) == -1) {
+            perror(shim);
+            exit(1);
+        }
+        setenv("LD_PRELOAD", shim, 1);
+        setenv("DUVIS_LATENCY", latency, 1);
+        setenv("DUVIS_JITTER", jitter, 1);
+    }
+
+    printf("# mode %s dir %s entries %" PRIu64 " latency %sus "
+           "jitter %sus repeats %d\n", mode_names[mode], dir, n_found,
+           latency, jitter, repeats);
+    printf("# %3s %5s %10s %12s\n", "thr", "depth", "seconds", "entries/s");
+    fflush(stdout);
+
+    /* The lists may be literals, so they are walked, not cut up. */
+    for (char *t = thread_list; *t; ) {
+        int n_threads = atoi(t);
+        if (n_threads < 1)
+            usage();
+        for (char *q = depth_list; *q; ) {
+            int depth = atoi(q);
+            if (depth < 1)
+                usage();
+            double best = 0;
+            for (int r = 0; r < repeats; r++) {
+                double s = run_scan(duvis, dir, mode, n_threads, depth);
+                if (r == 0 || s < best)
+                    best = s;
+            }
+            char depth_text[16] = "-";
+            if (mode == MODE_FANOUT)
+                snprintf(depth_text, sizeof(depth_text), "%d", depth);
+            printf("  %3d %5s %10.4f %12.0f\n",
+                   n_threads, depth_text, best, n_found / best);
+            fflush(stdout);
+            q += strcspn(q, ",");
+            q += *q == ',';
+        }
+        t += strcspn(t, ",");
+        t += *t == ',';
+    }
+    return 0;
+}
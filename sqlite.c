@@ -0,0 +1,153 @@
+/*
+ * Copyright © 2014 Bart Massey
+ * [This program is licensed under the "MIT License"]
+ * Please see the file COPYING in the source
+ * distribution of this software for license terms.
+ */
+
+/*
+ * SQLite export. The tree is walked in preorder straight
+ * into one prepared insert, so each node's id is its
+ * preorder number and the rows go in key order, appending
+ * to the table. Durability is switched off for the load,
+ * which is a single transaction, and the indexes are built
+ * once at the end rather than row by row.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "duvis.h"
+#include "mem.h"
+
+static const char *setup_sql =
+    "PRAGMA journal_mode = OFF;"
+    "PRAGMA synchronous = OFF;"
+    "PRAGMA locking_mode = EXCLUSIVE;"
+    "PRAGMA cache_size = -262144;"
+    "CREATE TABLE nodes ("
+    " id INTEGER PRIMARY KEY,"
+    " parent_id INTEGER,"
+    " name TEXT NOT NULL,"
+    " size INTEGER NOT NULL,"
+    " depth INTEGER NOT NULL,"
+    " descendants INTEGER NOT NULL);"
+    "BEGIN;";
+
+/* With --count-inodes, each directory's own counts too. */
+static const char *counts_sql =
+    "ALTER TABLE nodes ADD COLUMN entries INTEGER;"
+    "ALTER TABLE nodes ADD COLUMN subdirs INTEGER;";
+
+static const char *finish_sql =
+    "COMMIT;"
+    "CREATE INDEX nodes_parent ON nodes (parent_id);"
+    "CREATE INDEX nodes_size ON nodes (size);";
+
+struct load {
+    const char *file;
+    sqlite3 *db;
+    sqlite3_stmt *insert;
+    uint32_t *descendants;    // By entry index
+    int64_t next_id;
+    char name[DU_PATH_MAX + 1];
+};
+
+static void fail(struct load *l) {
+    fprintf(stderr, "%s: %s\n", l->file, sqlite3_errmsg(l->db));
+    exit(1);
+}
+
+/* Folded chains are one node, as in the text tree. */
+static uint32_t count_descendants(struct load *l, struct entry *e) {
+    struct entry *end = chain_end(e);
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < end->n_children; i++)
+        n += 1 + count_descendants(l, end->children[i]);
+    l->descendants[e - entries] = n;
+    return n;
+}
+
+static void insert_subtree(struct load *l, struct entry *e,
+                           int64_t parent_id, uint32_t depth) {
+    struct entry *end = chain_end(e);
+    int64_t id = l->next_id++;
+    sqlite3_stmt *s = l->insert;
+
+    if (!chain_name(e, depth, l->name, sizeof(l->name))) {
+        fprintf(stderr, "%s: path too long\n", l->file);
+        exit(1);
+    }
+    sqlite3_bind_int64(s, 1, id);
+    if (parent_id > 0)
+        sqlite3_bind_int64(s, 2, parent_id);
+    else
+        sqlite3_bind_null(s, 2);
+    sqlite3_bind_text(s, 3, l->name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(s, 4, e->size);
+    sqlite3_bind_int64(s, 5, depth);
+    sqlite3_bind_int64(s, 6, l->descendants[e - entries]);
+    if (dir_counts) {
+        uint32_t subdirs;
+        sqlite3_bind_int64(s, 7, dir_entries(e, &subdirs));
+        sqlite3_bind_int64(s, 8, subdirs);
+    }
+    if (sqlite3_step(s) != SQLITE_DONE)
+        fail(l);
+    sqlite3_reset(s);
+
+    for (uint32_t i = 0; i < end->n_children; i++)
+        insert_subtree(l, end->children[i], id, depth + 1);
+}
+
+/*
+ * Write the tree under root to a new SQLite database in
+ * file, as the table nodes (id, parent_id, name, size,
+ * depth, descendants), with entries and subdirs after
+ * them if dir_counts is set. The root is named by its full
+ * path and has a null parent_id.
+ */
+void write_sqlite(const char *file, struct entry *root) {
+    struct load l = {file, 0, 0, 0, 1};
+
+    if (unlink(file) == -1 && errno != ENOENT) {
+        perror(file);
+        exit(1);
+    }
+    if (sqlite3_open(file, &l.db) != SQLITE_OK)
+        fail(&l);
+    if (sqlite3_exec(l.db, setup_sql, 0, 0, 0) != SQLITE_OK)
+        fail(&l);
+    if (dir_counts && sqlite3_exec(l.db, counts_sql, 0, 0, 0) != SQLITE_OK)
+        fail(&l);
+    if (sqlite3_prepare_v2(l.db, dir_counts ?
+                           "INSERT INTO nodes VALUES (?, ?, ?, ?, ?, ?, ?, ?)" :
+                           "INSERT INTO nodes VALUES (?, ?, ?, ?, ?, ?)",
+                           -1, &l.insert, 0) != SQLITE_OK)
+        fail(&l);
+
+    l.descendants = mem_malloc(MEM_OUTPUT,
+                               n_entries * sizeof(l.descendants[0]));
+    if (!l.descendants) {
+        perror("malloc");
+        exit(1);
+    }
+    count_descendants(&l, root);
+    insert_subtree(&l, root, 0, 0);
+    mem_free(MEM_OUTPUT, l.descendants);
+
+    sqlite3_finalize(l.insert);
+    if (sqlite3_exec(l.db, finish_sql, 0, 0, 0) != SQLITE_OK)
+        fail(&l);
+    if (sqlite3_close(l.db) != SQLITE_OK)
+        fail(&l);
+}